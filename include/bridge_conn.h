@@ -0,0 +1,100 @@
+#ifndef BRIDGE_CONN_H
+#define BRIDGE_CONN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <libubox/list.h>
+#include <libubox/blobmsg.h>
+
+// ============== BRIDGE CLIENT CONNECTIONS ==============
+// Connections to /tmp/bridge_rpc.sock stay open and may carry any number of
+// newline-framed JSON-RPC requests, pipelined without waiting for replies.
+// A line must hold exactly one JSON object; anything after it but whitespace
+// makes the request invalid.
+// Each request reserves a reply slot. By default replies go out in request
+// order. With RPC_BRIDGE_REPLY_ORDER=any, each reply goes out as soon as it is
+// ready, and clients match replies to requests by "id".
+//
+// Ready replies are queued per connection. The queues are written from a
+// zero-delay uloop timeout, so everything that became ready in one loop
+// iteration leaves in a single sendmsg() per connection.
+//
+// A reply may be streamed: chunks appended to a slot go out as soon as the
+// slot is at the head of the queue, so a large reply never has to be held in
+// memory whole. In "any" mode a slot moves ahead of the slots that have not
+// produced anything yet when its first chunk arrives. A stream that is still
+// open keeps the slots behind it waiting.
+//
+// Large payloads (see payload.h): a request line may arrive as a memfd
+// envelope and is then handed to the line callback straight from the mapping,
+// so it is not bound by RPC_BRIDGE_MAX_LINE. For a slot marked accept_fd, a
+// chunk above RPC_PAYLOAD_INLINE_MAX (always one whole line) is sent as a
+// memfd instead of through the socket buffer.
+//
+// A connection is closed after RPC_BRIDGE_IDLE_MS without traffic and with
+// no outstanding requests, or once the client has shut down its write side
+// and all replies are flushed. Reading pauses while more than
+// RPC_BRIDGE_MAX_OUTPUT bytes of replies are queued for a slow reader, and
+// while RPC_BRIDGE_MAX_INFLIGHT requests are unanswered. Lines already read
+// stay buffered until a reply completes.
+//
+// Environment:
+//   RPC_BRIDGE_REPLY_ORDER   "request" (default) or "any"
+//   RPC_BRIDGE_IDLE_MS       idle timeout (default 30000)
+//   RPC_BRIDGE_MAX_OUTPUT    per-connection output queue limit (default 1 MiB)
+//   RPC_BRIDGE_MAX_INFLIGHT  unanswered requests per connection (default 64)
+//   RPC_BRIDGE_MAX_LINE      largest accepted request line (default 64 KiB)
+//   RPC_BRIDGE_MAX_STREAM    queued bytes at which a stream is refused (default 8 MiB)
+
+struct bridge_conn;
+struct conn_slot;
+
+// The connection of a slot whose reply is still being produced has closed
+// ('slot->conn' is already NULL). The producer may give up on the reply; it
+// still completes the slot to release it.
+typedef void (*conn_slot_orphan_cb)(struct conn_slot *slot);
+
+// One reply owed to a client, in request order
+struct conn_slot {
+    struct list_head list;
+    struct bridge_conn *conn;   // NULL once the connection is gone
+    uint64_t trace_id;
+    uint64_t ready_ns;          // first chunk queued
+    struct list_head chunks;    // unwritten reply bytes
+    bool started;               // at least one chunk queued
+    bool done;                  // last chunk queued
+    bool accept_fd;             // client takes large replies as a memfd
+    conn_slot_orphan_cb orphan; // optional, see above
+    void *priv;                 // for the producer
+};
+
+// Called for every complete request line (without '\n'); 'line' is only
+// valid during the call
+typedef void (*bridge_conn_line_cb)(struct bridge_conn *conn, const char *line, size_t len,
+                                    uint64_t read_ns);
+
+void bridge_conn_init(bridge_conn_line_cb cb);
+void bridge_conn_accept(int fd);
+
+int bridge_conn_peer_uid(struct bridge_conn *conn);
+
+// Close 'conn' as soon as the line callback returns, e.g. when a request
+// cannot even be given a reply slot. Replies still owed on it are dropped.
+void bridge_conn_abort(struct bridge_conn *conn);
+
+// Reserve the next reply position on 'conn'
+struct conn_slot *bridge_conn_slot(struct bridge_conn *conn, uint64_t trace_id);
+
+// Queue a partial reply (one whole line, copied). Returns -1 if the client is
+// gone or has fallen more than RPC_BRIDGE_MAX_STREAM behind; the producer
+// should stop.
+int bridge_conn_slot_append(struct conn_slot *slot, const char *data, size_t len);
+
+// Hand over the final (or only) part of the reply (malloc'd, ownership moves
+// to the slot; may be NULL). The slot must not be touched afterwards.
+void bridge_conn_slot_complete(struct conn_slot *slot, char *data, size_t len);
+
+void bridge_conn_stats(struct blob_buf *b);
+
+#endif
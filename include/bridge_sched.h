@@ -0,0 +1,70 @@
+#ifndef BRIDGE_SCHED_H
+#define BRIDGE_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/list.h>
+#include <libubox/blobmsg.h>
+
+// ============== REQUEST SCHEDULER ==============
+// Bridged requests are queued per traffic class instead of being forwarded in
+// arrival order. The control class is a strict-priority lane. The other classes
+// share the upstream by deficit round robin (quantum = weight, cost = 1 per
+// request). Every class also has its own in-flight limit, and there is a
+// global in-flight limit. A queued job can be withdrawn, e.g. when the client
+// that sent it has gone.
+//
+// Classification is by the method the bridge actually runs ("object.method"
+// for a ubus invoke, the JSON-RPC method towards rpc_server), never by a label
+// the client sent. A trusted caller is a ubus caller (Direction B, ubusd has
+// already applied its ACLs) or a client with SO_PEERCRED uid 0 (Direction A).
+// First match wins:
+//   method in RPC_SCHED_CONTROL_METHODS, trusted caller  -> control
+//   method in RPC_SCHED_BULK_METHODS                     -> bulk
+//   trusted caller                                       -> interactive
+//   anything else                                        -> bulk
+// Method lists are comma separated; a trailing '*' matches a prefix.
+//
+// Environment:
+//   RPC_SCHED_MAX_INFLIGHT        global in-flight limit (default 16)
+//   RPC_SCHED_CONTROL_METHODS     default "rpc.*,system.*"
+//   RPC_SCHED_BULK_METHODS        default ""
+//   RPC_SCHED_INTERACTIVE         "weight,max_inflight" (default "4,12")
+//   RPC_SCHED_BULK                "weight,max_inflight" (default "1,4")
+//   RPC_SCHED_CONTROL             "weight,max_inflight", weight unused (default "0,4")
+
+enum sched_class {
+    SCHED_CONTROL,
+    SCHED_INTERACTIVE,
+    SCHED_BULK,
+    __SCHED_CLASS_MAX,
+};
+
+struct sched_job;
+typedef void (*sched_run_t)(struct sched_job *job);
+
+struct sched_job {
+    struct list_head list;
+    enum sched_class cls;
+    uint64_t enqueue_ns;
+    uint64_t dispatch_ns;
+    bool queued;            // waiting in its class queue
+    sched_run_t run;        // start the upstream work; call sched_done() when finished
+};
+
+void sched_init(void);
+
+// 'method' is what will run; 'peer_uid' is -1 when unknown
+enum sched_class sched_classify(const char *method, bool from_ubus, int peer_uid);
+const char *sched_class_name(enum sched_class cls);
+
+void sched_submit(struct sched_job *job, enum sched_class cls, sched_run_t run);
+void sched_done(struct sched_job *job);
+
+// Drop a job that has not been dispatched yet. Returns false if it is already
+// running (or was never submitted); it must then finish through sched_done().
+bool sched_cancel(struct sched_job *job);
+
+void sched_stats(struct blob_buf *b);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// ============== TRAFFIC CAPTURE ==============
+// Compact binary log of every bridged exchange, replayed by bridge_replay.
+//
+// File layout:
+//   "BRCAP01\n"                                 8-byte magic
+//   u64 start_realtime_ns                        wall clock when capture began
+//   records...
+//
+// Record layout (host byte order, fields packed):
+//   struct capture_hdr                           32 bytes
+//   method[method_len] payload[payload_len] reply[reply_len]
+//
+// Direction A payloads/replies are the raw JSON-RPC lines; Direction B
+// payloads/replies are the ubus messages formatted as JSON.
+//
+// A streamed reply (CAPTURE_F_STREAMED) holds every part in order, one per
+// line: the partial frames and the final frame for Direction A, each ubus
+// reply message for Direction B. Latency is measured to the end of the
+// exchange, not to the first part.
+//
+// Environment:
+//   RPC_CAPTURE_FILE   enable capture to this path
+
+#define CAPTURE_MAGIC       "BRCAP01\n"
+#define CAPTURE_MAGIC_LEN   8
+#define CAPTURE_ENV_FILE    "RPC_CAPTURE_FILE"
+
+#define CAPTURE_F_STREAMED  0x01    // capture_hdr.flags: reply has several parts
+
+enum capture_dir {
+    CAPTURE_DIR_A = 'A',    // RPC client -> bridge -> ubus
+    CAPTURE_DIR_B = 'B',    // ubus caller -> bridge -> rpc_server
+};
+
+struct capture_hdr {
+    uint8_t  direction;     // enum capture_dir
+    uint8_t  flags;         // CAPTURE_F_*
+    uint16_t method_len;
+    uint32_t payload_len;
+    uint32_t reply_len;
+    int32_t  status;        // ubus status (B) or 0/-1 (A)
+    uint64_t arrival_ns;    // monotonic, relative to capture start
+    uint64_t latency_ns;
+} __attribute__((packed));
+
+struct capture_record {
+    struct capture_hdr hdr;
+    char *method;           // NUL-terminated copies owned by the record
+    char *payload;
+    char *reply;
+};
+
+// Parts of a streamed reply, collected while capturing. Each part is stored
+// as one line ('\n' added if missing).
+struct capture_parts {
+    char *data;
+    size_t len;
+    unsigned int count;
+};
+
+// Writer side (bridge)
+int capture_init(void);
+bool capture_enabled(void);
+void capture_record(enum capture_dir dir, const char *method,
+                    const char *payload, size_t payload_len,
+                    const char *reply, size_t reply_len,
+                    int status, uint64_t arrival_ns, uint64_t latency_ns, bool streamed);
+void capture_parts_add(struct capture_parts *parts, const char *data, size_t len);
+void capture_parts_free(struct capture_parts *parts);
+void capture_flush(void);
+void capture_shutdown(void);
+
+// Reader side (bridge_replay)
+FILE *capture_open(const char *path, uint64_t *start_realtime_ns);
+int capture_read(FILE *fp, struct capture_record *rec);     // 1 record, 0 EOF, -1 error
+void capture_record_free(struct capture_record *rec);
+
+#endif
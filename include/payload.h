@@ -0,0 +1,74 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// ============== LARGE PAYLOAD OFFLOAD ==============
+// A message larger than RPC_PAYLOAD_INLINE_MAX is not written to the socket.
+// It is copied once into a memfd, which is then sealed against writes and
+// resizing. The fd travels with SCM_RIGHTS attached to a small envelope line:
+//
+//   {"memfd":<size>}\n
+//
+// The receiver maps the memfd read-only and parses the message in place. Only
+// peers that announced "accept_fd":true in their request get replies this
+// way. Requests may always be sent this way to a peer that reads with
+// payload_recv(). Envelopes and fds are matched in arrival order.
+//
+// Environment:
+//   RPC_PAYLOAD_INLINE_MAX   largest message sent inline (default 65536)
+//   RPC_PAYLOAD_MAX          largest payload a receiver maps (default 64 MiB)
+
+#define PAYLOAD_MAX_FDS     8       // fds taken from one recvmsg()
+#define PAYLOAD_ENVELOPE_MAX 40     // '{"memfd":<size>}\n' and NUL
+
+// Received fds waiting for their envelope line
+struct payload_fds {
+    int fd[PAYLOAD_MAX_FDS];
+    unsigned int count;
+};
+
+// Read-only view of a received payload
+struct payload_map {
+    const char *data;       // not NUL-terminated
+    size_t len;             // message length, trailing '\n' excluded
+    size_t size;            // mapped length
+};
+
+void payload_config_load(void);
+size_t payload_inline_max(void);
+
+// Sealed memfd holding a copy of 'data', or -1
+int payload_memfd(const void *data, size_t len);
+
+// Envelope line for a memfd of 'size' bytes into 'buf'; returns its length
+size_t payload_envelope(char *buf, size_t buflen, size_t size);
+
+// True if 'line' (without '\n') is an envelope; its size goes to '*size'
+bool payload_is_envelope(const char *line, size_t len, size_t *size);
+
+// One sendmsg() of 'data' with 'fd' attached (-1 for none); MSG_NOSIGNAL is
+// added to 'flags'. The fd is delivered with the first byte sent.
+ssize_t payload_sendmsg(int sock, const void *data, size_t len, int fd, int flags);
+ssize_t payload_sendmsg_iov(int sock, const struct iovec *iov, int iovcnt, int fd, int flags);
+
+// Write a complete message line: inline if small (or 'allow_fd' is false),
+// otherwise as memfd + envelope. Blocking socket. Returns 0 or -1.
+int payload_write_line(int sock, const char *line, size_t len, bool allow_fd);
+
+// recvmsg() that queues any fds received into 'fds' (extra fds are closed)
+ssize_t payload_recv(int sock, void *buf, size_t len, struct payload_fds *fds);
+
+// Map the next queued fd for an envelope of 'size' bytes. The fd must be a
+// memfd sealed against write/shrink and of exactly 'size' bytes. The fd is
+// consumed either way. Returns 0 or -1.
+int payload_map_next(struct payload_fds *fds, size_t size, struct payload_map *map);
+void payload_unmap(struct payload_map *map);
+
+void payload_fds_close(struct payload_fds *fds);
+
+#endif
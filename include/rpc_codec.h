@@ -0,0 +1,49 @@
+#ifndef RPC_CODEC_H
+#define RPC_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <json-c/json.h>
+#include "rpc_schema.h"
+
+struct blob_attr;
+
+// ============== JSON-RPC CODEC ==============
+// Encoding and decoding steps on the bridge hot path. They live here so that
+// bridge_microbench times exactly the code the bridge runs. Messages with a
+// schema (schema/rpc.schema) go through the generated readers and writers.
+
+// Build one newline-terminated JSON-RPC request for rpc_server (malloc'd)
+// e.g. '{"id":1,"method":"greet.welcome","params":{"name":"Shripad"},"trace_id":"..."}'
+char *rpc_build_request(const char *method, const struct greet_welcome_params *params, int id,
+                        uint64_t trace_id, size_t *len);
+
+// Read a bridge client's request line into 'req' and its params. Returns
+// RPC_JSON_INVALID if the line is not a JSON object, RPC_JSON_MISSING if the
+// params lack a name; 'req' is filled in either way. Free both in any case.
+int rpc_read_request(const char *buf, size_t len, struct rpc_request *req,
+                     struct greet_welcome_params *params);
+
+// Read an rpc_server reply line. RPC_JSON_OK with result.message in 'result',
+// RPC_JSON_MISSING without one (e.g. the final frame of a streamed reply),
+// RPC_JSON_INVALID if the line is not a JSON object. Free both in any case.
+int rpc_read_reply(const char *buf, size_t len, struct rpc_reply *reply,
+                   struct greet_welcome_result *result);
+
+// Result of a greet.welcome ubus reply as JSON (malloc'd); replies with
+// members the schema does not know are formatted generically
+char *rpc_result_json(struct blob_attr *msg);
+
+// Reply lines, built with the generated rpc_reply/rpc_error writers (malloc'd)
+// '{"id":X,"result":<result_json>,"error":null}\n'
+char *rpc_format_result(int id, const char *result_json);
+// '{"id":X,"partial":<partial_json>}\n', length in '*len'
+char *rpc_format_partial(int id, const char *partial_json, size_t *len);
+// '{"id":X,"result":null,"error":{"code":C,"message":"..."}}\n'
+char *rpc_format_error(int id, int code, const char *message);
+
+// Parse exactly 'len' bytes into a json-c tree (no NUL needed), for values
+// without a schema such as the contents of a partial frame
+json_object *rpc_parse(const char *buf, size_t len);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef RPC_JSON_H
+#define RPC_JSON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ============== SCHEMA JSON RUNTIME ==============
+// Building blocks for the readers and writers that rpc_schemagen generates
+// from schema/rpc.schema (see _gen/rpc_schema.h). A generated reader walks
+// one object's members with rpc_jscan, looks each key up in a perfect hash of
+// the known field names and decodes the value straight into a struct field.
+// Unknown members, values of the wrong type and nulls are skipped. No
+// document tree is built. Writers append to an rpc_jbuf.
+
+// Reader results
+enum {
+    RPC_JSON_OK      = 0,
+    RPC_JSON_INVALID = -1,  // not a JSON object
+    RPC_JSON_MISSING = -2,  // a required field is absent
+};
+
+// Cursor over one JSON object
+struct rpc_jscan {
+    const char *p;
+    const char *end;
+    bool first;             // no member read yet
+    char **arena;           // owner's string storage, allocated on first use
+    char *arena_pos;
+    size_t arena_size;
+};
+
+// Expect '{' at the start of 'json'. Decoded strings go to '*arena', which
+// the owner frees. Returns 0 or -1.
+int rpc_jscan_begin(struct rpc_jscan *s, const char *json, size_t len, char **arena);
+
+// Next member: 1 with the (still escaped) key and the cursor on the value,
+// 0 at the closing '}' (nothing but whitespace may follow), -1 on bad input
+int rpc_jscan_key(struct rpc_jscan *s, const char **key, size_t *klen);
+
+// Value readers: 1 stored, 0 null or other type (skipped), -1 on bad input.
+// A string is NUL-terminated, in the arena; \u0000 (it would cut the string
+// short) and unpaired UTF-16 surrogates are bad input.
+int rpc_jscan_string(struct rpc_jscan *s, const char **out);
+int rpc_jscan_int(struct rpc_jscan *s, int *out);
+int rpc_jscan_bool(struct rpc_jscan *s, bool *out);
+int rpc_jscan_raw(struct rpc_jscan *s, const char **out, size_t *len);  // JSON text, in the input
+
+// Skip one value of any type. Skipped and raw values are still checked
+// against the JSON grammar: key/colon/value/comma order at every level,
+// number syntax and the literals. 0, or -1 on bad input.
+int rpc_jscan_skip(struct rpc_jscan *s);
+
+// Growing output buffer; any allocation failure sticks and fails rpc_jbuf_finish()
+struct rpc_jbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+};
+
+void rpc_jbuf_init(struct rpc_jbuf *jb, size_t hint);
+void rpc_jbuf_raw(struct rpc_jbuf *jb, const char *data, size_t len);
+void rpc_jbuf_char(struct rpc_jbuf *jb, char c);
+void rpc_jbuf_str(struct rpc_jbuf *jb, const char *s);     // quoted and escaped
+void rpc_jbuf_int(struct rpc_jbuf *jb, int v);
+void rpc_jbuf_bool(struct rpc_jbuf *jb, bool v);
+
+// NUL-terminated result (malloc'd, '*len' without the NUL), or NULL
+char *rpc_jbuf_finish(struct rpc_jbuf *jb, size_t *len);
+void rpc_jbuf_free(struct rpc_jbuf *jb);
+
+#endif
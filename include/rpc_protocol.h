@@ -4,4 +4,24 @@
 #define RPC_SOCK_PATH "/tmp/greet_rpc.sock"
 #define BRIDGE_SOCK_PATH "/tmp/bridge_rpc.sock"
 
+// Optional request member carrying the trace id (16 hex digits) across hops
+#define RPC_TRACE_ID_KEY "trace_id"
+
+// Liveness probe answered by rpc_server without touching any handler
+#define RPC_PING_METHOD "rpc.ping"
+
+// Streaming replies: a request with "stream":true accepts any number of
+// partial frames before the normal final reply, one JSON object per line:
+//   {"id":1,"partial":{...}}
+//   {"id":1,"partial":{...}}
+//   {"id":1,"result":...,"error":null}
+#define RPC_STREAM_KEY "stream"
+#define RPC_PARTIAL_KEY "partial"
+
+// Large messages: a line above RPC_PAYLOAD_INLINE_MAX may be replaced by the
+// envelope '{"memfd":<size>}' with a sealed memfd attached (SCM_RIGHTS) that
+// holds the actual line; see payload.h. Requests may always arrive this way;
+// replies only to a request that carried "accept_fd":true.
+#define RPC_ACCEPT_FD_KEY "accept_fd"
+
 #endif
@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ============== REQUEST TRACING ==============
+// Every request gets a 64-bit trace id which travels over the upstream hop as
+// the "trace_id" member of the JSON-RPC message. Each stage is timed with
+// CLOCK_MONOTONIC (shared by all processes on the host), so spans from the
+// bridge and rpc_server line up on a single timeline.
+//
+// Spans always go into an in-memory ring buffer. The ring is written out as
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) on SIGUSR1.
+// Optionally, spans of sampled traces are also streamed to a file as they
+// complete.
+//
+// Environment:
+//   RPC_TRACE_DUMP    path written on SIGUSR1 (default /tmp/<process>.trace.json)
+//   RPC_TRACE_FILE    enable continuous export to this path
+//   RPC_TRACE_SAMPLE  continuous export keeps 1 of every N traces (default 1)
+
+#define TRACE_RING_SIZE     4096
+#define TRACE_ID_STR_LEN    17      // 16 hex digits + '\0'
+
+#define TRACE_ENV_DUMP      "RPC_TRACE_DUMP"
+#define TRACE_ENV_FILE      "RPC_TRACE_FILE"
+#define TRACE_ENV_SAMPLE    "RPC_TRACE_SAMPLE"
+
+void trace_init(const char *process_name);
+void trace_shutdown(void);
+
+uint64_t trace_now_ns(void);
+uint64_t trace_new_id(void);
+
+// 'name' must be a string literal (the ring stores the pointer)
+void trace_span(uint64_t trace_id, const char *name, uint64_t start_ns, uint64_t end_ns);
+
+// Write the ring buffer to 'path' (NULL = RPC_TRACE_DUMP path)
+int trace_dump(const char *path);
+
+// Flush continuous export and service a pending SIGUSR1 dump; call from the
+// main loop between requests
+void trace_poll(void);
+
+void trace_id_to_str(uint64_t id, char buf[TRACE_ID_STR_LEN]);
+uint64_t trace_id_from_str(const char *str);
+
+#endif
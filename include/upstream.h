@@ -0,0 +1,137 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/uloop.h>
+#include <libubox/blobmsg.h>
+#include "payload.h"
+
+// ============== UPSTREAM HEALTH / CIRCUIT BREAKER ==============
+// Each rpc_server endpoint has a small state machine:
+//
+//   CLOSED --(N consecutive failures or N consecutive slow calls)--> OPEN
+//   OPEN   --(probe timer, exponential backoff)--> HALF_OPEN
+//   HALF_OPEN --(probe ok)--> CLOSED     HALF_OPEN --(probe fails)--> OPEN
+//
+// While not CLOSED, calls are rejected without touching the socket. Probes
+// are started by a uloop timer and send "rpc.ping" as a non-blocking
+// upstream_call, so a hung server never stalls the event loop.
+//
+// Environment:
+//   RPC_UPSTREAM_TIMEOUT_MS  connect/send/receive limit per call (default 2000)
+//   RPC_BREAKER_FAILURES     consecutive failures/outliers that open (default 5)
+//   RPC_BREAKER_SLOW_MS      latency counted as an outlier (default 1000)
+//   RPC_BREAKER_BACKOFF_MS   first probe delay, doubled per failed probe (default 500)
+//   RPC_BREAKER_BACKOFF_MAX_MS  probe delay cap (default 30000)
+
+enum upstream_state {
+    UPSTREAM_CLOSED,
+    UPSTREAM_OPEN,
+    UPSTREAM_HALF_OPEN,
+};
+
+// Result of one upstream call
+enum {
+    UPSTREAM_OK       = 0,
+    UPSTREAM_ERROR    = -1,     // connect/write/read failure or bad reply
+    UPSTREAM_TIMEOUT  = -2,     // no reply within RPC_UPSTREAM_TIMEOUT_MS
+    UPSTREAM_REJECTED = -3,     // circuit open, call not attempted
+};
+
+struct upstream_call;
+
+struct upstream {
+    const char *path;
+    enum upstream_state state;
+
+    unsigned int consecutive_failures;
+    unsigned int consecutive_slow;
+    uint64_t latency_ewma_ns;
+    unsigned int backoff_ms;
+    struct uloop_timeout probe_timer;
+    struct upstream_call *probe_call;   // half-open probe in flight, or NULL
+    unsigned int outstanding;   // async calls in flight (load balancing input)
+
+    // Counters reported by upstream_stats()
+    unsigned long calls;
+    unsigned long failures;
+    unsigned long timeouts;
+    unsigned long slow;
+    unsigned long rejected;
+    unsigned long opens;
+    unsigned long probes;
+};
+
+void upstream_config_load(void);
+void upstream_init(struct upstream *u, const char *path);
+
+// Gate before a call and outcome after it
+bool upstream_allow(struct upstream *u);
+void upstream_record(struct upstream *u, int result, uint64_t latency_ns);
+
+const char *upstream_state_name(enum upstream_state state);
+void upstream_stats(struct blob_buf *b, const struct upstream *u);
+
+// ============== ASYNC UPSTREAM CALL ==============
+// One non-blocking request/reply exchange driven by uloop. The reply is the
+// first line the server sends (without the '\n'), or everything up to EOF.
+// Calls are gated by the circuit breaker and feed upstream_record().
+//
+// Streaming: with a line callback set, every reply line is offered to it as
+// it arrives, and only the line it reports as final ends the call. Each
+// partial line restarts the timeout. The socket is read only as fast as the
+// callback consumes lines, so memory is bounded by the longest line. The
+// breaker sees the time to the first line as the call's latency.
+//
+// Large payloads: a request above RPC_PAYLOAD_INLINE_MAX is sent as a sealed
+// memfd, and a reply line that is a memfd envelope is mapped and handed on in
+// place of the envelope (see payload.h). Lines are therefore not NUL-terminated.
+
+typedef void (*upstream_call_cb)(struct upstream_call *call, int result);
+
+// Return nonzero if 'line' ('len' bytes, valid during the call) is the final reply
+typedef int (*upstream_line_cb)(struct upstream_call *call, const char *line, size_t len);
+
+struct upstream_call {
+    struct upstream *u;
+    struct uloop_fd fd;
+    struct uloop_timeout timer;
+    upstream_call_cb cb;
+    upstream_line_cb line_cb;   // optional, set right after upstream_call_start()
+    bool probe;             // breaker probe: not gated, not fed to upstream_record()
+
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t sent_ns;
+    uint64_t first_line_ns;     // first partial line, streaming only
+
+    char *out;              // request (or its memfd envelope), owned by the call
+    size_t out_len;
+    size_t out_off;
+    int out_fd;             // memfd sent with the first byte of 'out', or -1
+
+    char *in;               // received, not yet consumed bytes
+    size_t in_len;
+    size_t in_cap;
+    struct payload_fds fds; // received fds waiting for their envelope
+    struct payload_map map; // current line when it arrived as a memfd
+
+    const char *reply;      // final reply ('reply_len' bytes), valid in the callback
+    size_t reply_len;
+};
+
+// Takes ownership of 'request' (malloc'd). Returns UPSTREAM_OK when the call
+// is in flight and 'cb' will run; UPSTREAM_REJECTED/ERROR when it failed
+// immediately, in which case 'cb' is never called.
+int upstream_call_start(struct upstream_call *call, struct upstream *u,
+                        char *request, size_t len, uint64_t trace_id,
+                        upstream_call_cb cb);
+
+// Abort an in-flight call without running its callback
+void upstream_call_cancel(struct upstream_call *call);
+
+// Release the reply buffer (or mapping) once the callback is done with it
+void upstream_call_free(struct upstream_call *call);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef UPSTREAM_POOL_H
+#define UPSTREAM_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libubox/uloop.h>
+#include <libubox/blobmsg.h>
+#include "upstream.h"
+
+// ============== UPSTREAM POOL / LOAD BALANCING ==============
+// Direction B can spread calls over several rpc_server instances. Each
+// instance keeps its own circuit breaker. Instances whose circuit is not
+// closed are skipped while others are available.
+//
+// Policies:
+//   least  the instance with the fewest calls in flight (ties: lowest latency EWMA)
+//   hash   consistent hashing of one request param onto a ring with
+//          UPSTREAM_POOL_VNODES points per instance, so a key keeps hitting
+//          the same instance while the set of healthy instances is stable
+//
+// Hedging: if the chosen instance has not answered within the observed p95
+// latency, the same request is sent to a second instance. The first reply
+// wins and the other call is cancelled. A failure only ends the exchange
+// when no other call is still in flight. Once one call has delivered a
+// partial frame of a streamed reply, it is committed and the other is cancelled.
+// The p95 is taken from primary calls only, so hedges do not pull it down. A
+// primary that lost to its hedge counts with the time it had run when it was
+// cancelled, a lower bound on its latency. Hedging starts once
+// POOL_HEDGE_MIN_SAMPLES primaries have been sampled and a p95 exists.
+//
+// Retries: a primary that is rejected or fails (other than by timing out)
+// before any part of its reply was forwarded is sent once to another
+// instance. Retries and hedges share the second call slot.
+//
+// Environment:
+//   RPC_UPSTREAMS            comma-separated socket paths (default RPC_SOCK_PATH)
+//   RPC_BALANCE              "least" (default) or "hash"
+//   RPC_BALANCE_HASH_PARAM   param whose value is hashed (default "name")
+//   RPC_HEDGE                1 to enable hedged requests (default 0)
+//   RPC_HEDGE_MIN_MS         lower bound on the hedge delay (default 5)
+
+#define UPSTREAM_POOL_MAX       8
+#define UPSTREAM_POOL_VNODES    64
+#define UPSTREAM_POOL_LAT_RING  256     // recent latencies the p95 is taken from
+
+enum upstream_policy {
+    UPSTREAM_POLICY_LEAST,
+    UPSTREAM_POLICY_HASH,
+};
+
+struct upstream_pool {
+    struct upstream upstreams[UPSTREAM_POOL_MAX];
+    char paths[UPSTREAM_POOL_MAX][108];     // sizeof(sun_path)
+    unsigned int n;
+
+    enum upstream_policy policy;
+    char hash_param[32];
+    struct {
+        uint32_t point;
+        unsigned int idx;
+    } ring[UPSTREAM_POOL_MAX * UPSTREAM_POOL_VNODES];
+    unsigned int ring_len;
+
+    bool hedge;
+    unsigned int hedge_min_ms;
+    uint64_t latency[UPSTREAM_POOL_LAT_RING];
+    unsigned int latency_count;
+    unsigned int latency_pos;
+    uint64_t p95_ns;
+
+    // Counters reported by upstream_pool_stats()
+    unsigned long hedges;
+    unsigned long hedge_wins;
+    unsigned long cancelled;
+    unsigned long retries;
+};
+
+struct pool_call;
+typedef void (*pool_call_cb)(struct pool_call *pc, int result);
+typedef int (*pool_line_cb)(struct pool_call *pc, const char *line, size_t len);
+
+struct pool_call {
+    struct upstream_pool *pool;
+    struct upstream_call calls[2];  // [0] primary, [1] hedge or retry
+    struct uloop_timeout hedge_timer;
+    pool_call_cb cb;
+    pool_line_cb line_cb;
+    uint64_t trace_id;
+    uint32_t key_hash;
+
+    char *request;          // copy kept for a retry or hedge, NULL once used
+    size_t request_len;
+    unsigned int active;    // calls still in flight
+    bool committed;         // a partial frame was forwarded, no more hedging
+    bool retried;           // calls[1] is a retry of a failed primary, not a hedge
+
+    const char *reply;      // winning call's reply ('reply_len' bytes), valid in the callback
+    size_t reply_len;
+    struct upstream *winner;
+};
+
+void upstream_pool_init(struct upstream_pool *pool, const char *default_path);
+
+// Name of the param hashed by the "hash" policy, NULL for other policies
+const char *upstream_pool_hash_param(const struct upstream_pool *pool);
+
+// Same contract as upstream_call_start(). 'key' is the hash param value and
+// may be NULL. Returns UPSTREAM_REJECTED when every instance's circuit is open.
+int pool_call_start(struct pool_call *pc, struct upstream_pool *pool, const char *key,
+                    char *request, size_t len, uint64_t trace_id, pool_call_cb cb);
+
+// Stream the reply (see upstream_line_cb); call right after a successful start
+void pool_call_stream(struct pool_call *pc, pool_line_cb line_cb);
+
+// Release reply buffers once the callback is done with them
+void pool_call_free(struct pool_call *pc);
+
+void upstream_pool_stats(struct blob_buf *b, const struct upstream_pool *pool);
+
+#endif
@@ -0,0 +1,643 @@
+#define _GNU_SOURCE     // struct ucred (SO_PEERCRED)
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libubox/uloop.h>
+#include "log.h"
+#include "trace.h"
+#include "payload.h"
+#include "bridge_conn.h"
+
+#define CONN_READ_CHUNK     4096
+#define CONN_MAX_IOV        64
+
+struct conn_chunk {
+    struct list_head list;
+    char *data;
+    size_t len;
+    size_t off;             // bytes already written
+    int fd;                 // memfd the chunk is the envelope for, or -1
+};
+
+struct bridge_conn {
+    struct uloop_fd fd;
+    struct uloop_timeout idle_timer;
+    struct list_head slots;         // replies owed, in request order
+    struct list_head flush_list;    // linked on 'dirty_conns' while output is pending
+    bool dirty;
+
+    char *in;                       // partial request line(s)
+    size_t in_len;
+    size_t in_cap;
+    struct payload_fds fds;         // received memfds waiting for their envelope
+
+    size_t out_bytes;               // ready but unwritten reply bytes
+    unsigned int outstanding;       // slots still waiting for their reply
+    int peer_uid;
+
+    bool eof;                       // client shut down its write side
+    bool paused;                    // reading stopped by output backpressure
+    bool want_write;                // socket buffer full, wait for ULOOP_WRITE
+    bool aborted;                   // close once the current line is handled
+};
+
+static struct {
+    bool any_order;
+    unsigned int idle_ms;
+    size_t max_output;
+    unsigned int max_inflight;
+    size_t max_line;
+    size_t max_stream;
+} cfg = {
+    .any_order = false,
+    .idle_ms = 30000,
+    .max_output = 1024 * 1024,
+    .max_inflight = 64,
+    .max_line = 64 * 1024,
+    .max_stream = 8 * 1024 * 1024,
+};
+
+static struct {
+    unsigned long accepted;
+    unsigned long open;
+    unsigned long requests;
+    unsigned long replies;
+    unsigned long sendmsg_calls;
+    unsigned long bytes_out;
+    unsigned long idle_closes;
+    unsigned long paused;
+    unsigned long inflight_paused;
+    unsigned long chunks;
+    unsigned long streams_refused;
+    unsigned long memfd_in;
+    unsigned long memfd_out;
+} stats;
+
+static bridge_conn_line_cb line_cb;
+static LIST_HEAD(dirty_conns);
+
+static void conn_flush_all(struct uloop_timeout *t);
+static bool conn_process_lines(struct bridge_conn *conn, uint64_t read_ns);
+static struct uloop_timeout flush_timer = {.cb = conn_flush_all};
+
+static size_t env_size(const char *name, size_t def)
+{
+    const char *val = getenv(name);
+    if (!val || !*val)
+        return def;
+
+    unsigned long v = strtoul(val, NULL, 10);
+    return v ? (size_t)v : def;
+}
+
+void bridge_conn_init(bridge_conn_line_cb cb)
+{
+    const char *order = getenv("RPC_BRIDGE_REPLY_ORDER");
+
+    line_cb = cb;
+    cfg.any_order = order && strcmp(order, "any") == 0;
+    cfg.idle_ms = (unsigned int)env_size("RPC_BRIDGE_IDLE_MS", cfg.idle_ms);
+    cfg.max_output = env_size("RPC_BRIDGE_MAX_OUTPUT", cfg.max_output);
+    cfg.max_inflight = (unsigned int)env_size("RPC_BRIDGE_MAX_INFLIGHT", cfg.max_inflight);
+    cfg.max_line = env_size("RPC_BRIDGE_MAX_LINE", cfg.max_line);
+    cfg.max_stream = env_size("RPC_BRIDGE_MAX_STREAM", cfg.max_stream);
+
+    log_debug("bridge_conn: reply order=%s idle=%ums max_output=%zu max_inflight=%u max_line=%zu "
+              "max_stream=%zu", cfg.any_order ? "any" : "request", cfg.idle_ms, cfg.max_output,
+              cfg.max_inflight, cfg.max_line, cfg.max_stream);
+}
+
+int bridge_conn_peer_uid(struct bridge_conn *conn)
+{
+    return conn->peer_uid;
+}
+
+void bridge_conn_abort(struct bridge_conn *conn)
+{
+    conn->aborted = true;
+}
+
+// Too many unanswered requests: take no more until a reply completes
+static bool conn_at_inflight_limit(const struct bridge_conn *conn)
+{
+    return conn->outstanding >= cfg.max_inflight;
+}
+
+static void conn_update_events(struct bridge_conn *conn)
+{
+    unsigned int events = 0;
+
+    if (!conn->eof && !conn->paused && !conn_at_inflight_limit(conn))
+        events |= ULOOP_READ;
+    if (conn->want_write)
+        events |= ULOOP_WRITE;
+
+    uloop_fd_add(&conn->fd, events);    // no events = removed from the loop
+}
+
+static void slot_free_chunks(struct conn_slot *slot)
+{
+    struct conn_chunk *chunk, *tmp;
+
+    list_for_each_entry_safe(chunk, tmp, &slot->chunks, list) {
+        list_del(&chunk->list);
+        if (chunk->fd >= 0)
+            close(chunk->fd);
+        free(chunk->data);
+        free(chunk);
+    }
+}
+
+static void conn_close(struct bridge_conn *conn)
+{
+    struct conn_slot *slot, *tmp;
+
+    // Replies still being produced are dropped when they complete; their
+    // producers are told so work that has not started can be dropped too
+    list_for_each_entry_safe(slot, tmp, &conn->slots, list) {
+        list_del_init(&slot->list);
+        slot_free_chunks(slot);
+        if (slot->done) {
+            free(slot);
+        } else {
+            slot->conn = NULL;
+            if (slot->orphan)
+                slot->orphan(slot);
+        }
+    }
+
+    if (conn->dirty)
+        list_del(&conn->flush_list);
+
+    uloop_timeout_cancel(&conn->idle_timer);
+    uloop_fd_delete(&conn->fd);
+    close(conn->fd.fd);
+    log_debug("Bridge client disconnected (fd=%d)", conn->fd.fd);
+
+    payload_fds_close(&conn->fds);
+    free(conn->in);
+    free(conn);
+    stats.open--;
+}
+
+static bool conn_idle(const struct bridge_conn *conn)
+{
+    return !conn->outstanding && list_empty(&conn->slots);
+}
+
+// Close once the client is done sending and every reply is out
+static bool conn_maybe_finish(struct bridge_conn *conn)
+{
+    if (conn->eof && conn_idle(conn)) {
+        conn_close(conn);
+        return true;
+    }
+    return false;
+}
+
+static void conn_idle_cb(struct uloop_timeout *t)
+{
+    struct bridge_conn *conn = container_of(t, struct bridge_conn, idle_timer);
+
+    if (conn_idle(conn)) {
+        stats.idle_closes++;
+        log_debug("Bridge client idle for %ums, closing (fd=%d)", cfg.idle_ms, conn->fd.fd);
+        conn_close(conn);
+        return;
+    }
+
+    uloop_timeout_set(&conn->idle_timer, cfg.idle_ms);
+}
+
+static void conn_mark_dirty(struct bridge_conn *conn)
+{
+    if (!conn->dirty) {
+        conn->dirty = true;
+        list_add_tail(&conn->flush_list, &dirty_conns);
+    }
+    if (!flush_timer.pending)
+        uloop_timeout_set(&flush_timer, 0);
+}
+
+// Write the queued chunks, from the head of the slot list up to and including
+// the first slot that is still streaming, with as few sendmsg() calls as the
+// socket buffer allows. A sendmsg() carries at most one memfd. Returns false
+// if the connection was closed.
+static bool conn_flush(struct bridge_conn *conn)
+{
+    while (!list_empty(&conn->slots)) {
+        struct iovec iov[CONN_MAX_IOV];
+        int iovcnt = 0;
+        size_t total = 0;
+        struct conn_slot *slot, *tmp;
+        struct conn_chunk *chunk, *ctmp;
+        struct conn_chunk *fd_chunk = NULL;
+        bool full = false;
+
+        list_for_each_entry(slot, &conn->slots, list) {
+            list_for_each_entry(chunk, &slot->chunks, list) {
+                if (iovcnt == CONN_MAX_IOV || (chunk->fd >= 0 && fd_chunk)) {
+                    full = true;
+                    break;
+                }
+                if (chunk->fd >= 0)
+                    fd_chunk = chunk;
+                iov[iovcnt].iov_base = chunk->data + chunk->off;
+                iov[iovcnt].iov_len = chunk->len - chunk->off;
+                total += iov[iovcnt].iov_len;
+                iovcnt++;
+            }
+            if (!slot->done || full)
+                break;
+        }
+
+        ssize_t n = 0;
+        if (iovcnt) {
+            n = payload_sendmsg_iov(conn->fd.fd, iov, iovcnt, fd_chunk ? fd_chunk->fd : -1,
+                                    MSG_DONTWAIT);
+            stats.sendmsg_calls++;
+
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    conn->want_write = true;
+                    break;
+                }
+                log_warn("Bridge client write failed: %s", strerror(errno));
+                conn_close(conn);
+                return false;
+            }
+
+            stats.bytes_out += n;
+            conn->out_bytes -= n;
+
+            // The memfd went out with the first byte, even on a short write
+            if (fd_chunk) {
+                close(fd_chunk->fd);
+                fd_chunk->fd = -1;
+                stats.memfd_out++;
+            }
+        }
+
+        bool short_write = (size_t)n < total;
+        bool progress = n > 0;
+        uint64_t now = trace_now_ns();
+
+        list_for_each_entry_safe(slot, tmp, &conn->slots, list) {
+            list_for_each_entry_safe(chunk, ctmp, &slot->chunks, list) {
+                size_t left = chunk->len - chunk->off;
+                if ((size_t)n < left) {
+                    chunk->off += n;
+                    n = 0;
+                    break;
+                }
+
+                n -= left;
+                list_del(&chunk->list);
+                if (chunk->fd >= 0)
+                    close(chunk->fd);
+                free(chunk->data);
+                free(chunk);
+            }
+
+            if (!slot->done || !list_empty(&slot->chunks))
+                break;
+
+            // Empty replies (e.g. out of memory) still release their slot
+            if (slot->started)
+                trace_span(slot->trace_id, "client.write", slot->ready_ns, now);
+            list_del(&slot->list);
+            free(slot);
+            stats.replies++;
+            progress = true;
+        }
+
+        if (short_write) {
+            conn->want_write = true;   // socket buffer is full
+            break;
+        }
+        conn->want_write = false;
+        if (!progress)
+            break;
+    }
+
+    if (conn->paused && conn->out_bytes <= cfg.max_output / 2)
+        conn->paused = false;
+
+    // Lines held back by the in-flight limit go on as replies complete
+    if (!conn_at_inflight_limit(conn) && conn->in_len && memchr(conn->in, '\n', conn->in_len)) {
+        if (!conn_process_lines(conn, trace_now_ns()))
+            return false;
+    }
+
+    conn_update_events(conn);
+    return !conn_maybe_finish(conn);
+}
+
+static void conn_flush_all(struct uloop_timeout *t)
+{
+    (void)t;
+
+    while (!list_empty(&dirty_conns)) {
+        struct bridge_conn *conn = list_first_entry(&dirty_conns, struct bridge_conn, flush_list);
+
+        list_del(&conn->flush_list);
+        conn->dirty = false;
+        if (!conn->want_write)
+            conn_flush(conn);
+    }
+}
+
+// Split buffered input into lines. Returns false if the connection was closed.
+static bool conn_process_lines(struct bridge_conn *conn, uint64_t read_ns)
+{
+    size_t start = 0;
+    char *nl;
+
+    while ((nl = memchr(conn->in + start, '\n', conn->in_len - start))) {
+        if (conn_at_inflight_limit(conn)) {
+            stats.inflight_paused++;
+            break;
+        }
+
+        const char *line = conn->in + start;
+        size_t len = nl - line;
+        size_t size;
+
+        if (len && line[len - 1] == '\r')
+            len--;
+
+        // A large request arrives as an envelope plus memfd: parse it in place
+        if (payload_is_envelope(line, len, &size)) {
+            struct payload_map map;
+            if (payload_map_next(&conn->fds, size, &map) < 0) {
+                log_error("Bridge client sent an unusable memfd envelope, closing");
+                conn_close(conn);
+                return false;
+            }
+            stats.memfd_in++;
+            stats.requests++;
+            line_cb(conn, map.data, map.len, read_ns);
+            payload_unmap(&map);
+        } else if (len) {
+            stats.requests++;
+            line_cb(conn, line, len, read_ns);
+        }
+        if (conn->aborted) {
+            conn_close(conn);
+            return false;
+        }
+        start = nl - conn->in + 1;
+    }
+
+    if (start) {
+        memmove(conn->in, conn->in + start, conn->in_len - start);
+        conn->in_len -= start;
+    }
+
+    // Only a line still without its '\n' counts against the limit
+    if (conn->in_len > cfg.max_line && !memchr(conn->in, '\n', conn->in_len)) {
+        log_error("Bridge client sent a request line over %zu bytes, closing", cfg.max_line);
+        conn_close(conn);
+        return false;
+    }
+
+    return true;
+}
+
+static void conn_read(struct bridge_conn *conn)
+{
+    uint64_t read_ns = trace_now_ns();
+
+    while (!conn->paused && !conn_at_inflight_limit(conn)) {
+        if (conn->in_cap - conn->in_len < CONN_READ_CHUNK) {
+            size_t cap = conn->in_cap ? conn->in_cap * 2 : CONN_READ_CHUNK * 2;
+            char *grown = realloc(conn->in, cap);
+            if (!grown) {
+                conn_close(conn);
+                return;
+            }
+            conn->in = grown;
+            conn->in_cap = cap;
+        }
+
+        ssize_t n = payload_recv(conn->fd.fd, conn->in + conn->in_len,
+                                 conn->in_cap - conn->in_len, &conn->fds);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            log_warn("Bridge client read failed: %s", strerror(errno));
+            conn_close(conn);
+            return;
+        }
+
+        if (n == 0) {
+            // A final request without '\n' still counts (e.g. printf | socat)
+            if (conn->in_len) {
+                conn->in[conn->in_len++] = '\n';
+                if (!conn_process_lines(conn, read_ns))
+                    return;
+            }
+            conn->eof = true;
+            break;
+        }
+
+        conn->in_len += n;
+        if (!conn_process_lines(conn, read_ns))
+            return;
+    }
+
+    uloop_timeout_set(&conn->idle_timer, cfg.idle_ms);
+    conn_update_events(conn);
+    conn_maybe_finish(conn);
+}
+
+static void conn_fd_cb(struct uloop_fd *u, unsigned int events)
+{
+    struct bridge_conn *conn = container_of(u, struct bridge_conn, fd);
+
+    if (events & ULOOP_WRITE) {
+        conn->want_write = false;
+        if (!conn_flush(conn))
+            return;
+    }
+
+    if (events & ULOOP_READ)
+        conn_read(conn);
+}
+
+void bridge_conn_accept(int fd)
+{
+    struct bridge_conn *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    conn->peer_uid = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 ? (int)cred.uid : -1;
+
+    conn->fd.fd = fd;
+    conn->fd.cb = conn_fd_cb;
+    conn->idle_timer.cb = conn_idle_cb;
+    INIT_LIST_HEAD(&conn->slots);
+
+    stats.accepted++;
+    stats.open++;
+
+    uloop_fd_add(&conn->fd, ULOOP_READ);
+    uloop_timeout_set(&conn->idle_timer, cfg.idle_ms);
+    log_debug("Bridge listener: Client connected (fd=%d, uid=%d)", fd, conn->peer_uid);
+}
+
+struct conn_slot *bridge_conn_slot(struct bridge_conn *conn, uint64_t trace_id)
+{
+    struct conn_slot *slot = calloc(1, sizeof(*slot));
+    if (!slot)
+        return NULL;
+
+    slot->conn = conn;
+    slot->trace_id = trace_id;
+    INIT_LIST_HEAD(&slot->chunks);
+    list_add_tail(&slot->list, &conn->slots);
+    conn->outstanding++;
+    return slot;
+}
+
+// Replace a large chunk (one whole line) by a memfd and its envelope
+static int chunk_offload(struct conn_chunk *chunk, char **data, size_t *len)
+{
+    int fd = payload_memfd(*data, *len);
+    char *env = fd >= 0 ? malloc(PAYLOAD_ENVELOPE_MAX) : NULL;
+
+    if (!env) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    free(*data);
+    *len = payload_envelope(env, PAYLOAD_ENVELOPE_MAX, *len);
+    *data = env;
+    chunk->fd = fd;
+    return 0;
+}
+
+static void slot_queue(struct conn_slot *slot, char *data, size_t len)
+{
+    struct bridge_conn *conn = slot->conn;
+
+    if (data && len) {
+        struct conn_chunk *chunk = calloc(1, sizeof(*chunk));
+        if (chunk) {
+            chunk->fd = -1;
+            if (slot->accept_fd && len > payload_inline_max())
+                chunk_offload(chunk, &data, &len);
+            chunk->data = data;
+            chunk->len = len;
+            list_add_tail(&chunk->list, &slot->chunks);
+            conn->out_bytes += len;
+            stats.chunks++;
+        } else {
+            free(data);
+        }
+    } else {
+        free(data);
+    }
+
+    // Out-of-order mode: move behind the slots that have already started so
+    // the list always starts with the bytes to send next
+    if (!slot->started) {
+        slot->started = true;
+        slot->ready_ns = trace_now_ns();
+
+        if (cfg.any_order) {
+            struct conn_slot *pos;
+            struct list_head *before = &conn->slots;
+
+            list_del(&slot->list);
+            list_for_each_entry(pos, &conn->slots, list) {
+                if (!pos->started) {
+                    before = &pos->list;
+                    break;
+                }
+            }
+            list_add_tail(&slot->list, before);
+        }
+    }
+
+    // Backpressure: stop taking requests while a slow reader has a full queue
+    if (!conn->paused && conn->out_bytes > cfg.max_output) {
+        conn->paused = true;
+        stats.paused++;
+        conn_update_events(conn);
+    }
+
+    conn_mark_dirty(conn);
+}
+
+int bridge_conn_slot_append(struct conn_slot *slot, const char *data, size_t len)
+{
+    struct bridge_conn *conn = slot->conn;
+
+    if (!conn)
+        return -1;      // client went away
+    if (conn->out_bytes > cfg.max_stream) {
+        stats.streams_refused++;
+        return -1;
+    }
+
+    char *copy = malloc(len);
+    if (!copy)
+        return -1;
+    memcpy(copy, data, len);
+
+    slot_queue(slot, copy, len);
+    return 0;
+}
+
+void bridge_conn_slot_complete(struct conn_slot *slot, char *data, size_t len)
+{
+    struct bridge_conn *conn = slot->conn;
+
+    if (!conn) {
+        free(data);     // client went away
+        free(slot);
+        return;
+    }
+
+    slot->done = true;
+    conn->outstanding--;
+    slot_queue(slot, data, len);
+}
+
+void bridge_conn_stats(struct blob_buf *b)
+{
+    void *tbl = blobmsg_open_table(b, "clients");
+
+    blobmsg_add_string(b, "reply_order", cfg.any_order ? "any" : "request");
+    blobmsg_add_u64(b, "accepted", stats.accepted);
+    blobmsg_add_u64(b, "open", stats.open);
+    blobmsg_add_u64(b, "requests", stats.requests);
+    blobmsg_add_u64(b, "replies", stats.replies);
+    blobmsg_add_u64(b, "sendmsg_calls", stats.sendmsg_calls);
+    blobmsg_add_u64(b, "bytes_out", stats.bytes_out);
+    blobmsg_add_u64(b, "idle_closes", stats.idle_closes);
+    blobmsg_add_u64(b, "paused", stats.paused);
+    blobmsg_add_u64(b, "inflight_paused", stats.inflight_paused);
+    blobmsg_add_u64(b, "chunks", stats.chunks);
+    blobmsg_add_u64(b, "streams_refused", stats.streams_refused);
+    blobmsg_add_u64(b, "memfd_in", stats.memfd_in);
+    blobmsg_add_u64(b, "memfd_out", stats.memfd_out);
+
+    blobmsg_close_table(b, tbl);
+}
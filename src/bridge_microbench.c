@@ -0,0 +1,467 @@
+#define _GNU_SOURCE     // syscall()
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <libubox/blobmsg.h>
+#include "log.h"
+#include "rpc_protocol.h"
+#include "rpc_codec.h"
+#include "rpc_schema_blob.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// ============== BRIDGE MICROBENCHMARK ==============
+// Times each bridge hot-path stage on its own over several payload sizes and
+// reports ns/op, allocations/op and cycles/op. With -b the results are
+// compared against a baseline file, and the exit status is 1 if a stage is
+// slower than the baseline by more than the threshold or allocates more, and
+// 2 if the baseline is missing (MICROBENCH_ALLOW_MISSING=1 only reports).
+//
+// Usage: bridge_microbench [-b baseline] [-w baseline] [-t pct] [-r rounds] [-f filter]
+//   -b FILE   compare with FILE (missing file fails unless MICROBENCH_ALLOW_MISSING=1)
+//   -w FILE   write the results to FILE as the new baseline
+//   -t PCT    allowed ns/op regression in percent (default 15, or MICROBENCH_THRESHOLD)
+//   -r N      timed rounds per stage, the fastest counts (default 5)
+//   -f STR    only run stages whose name contains STR
+//
+// stdout is redirected to /dev/null while stages run, so the log.h output
+// produced by the measured code costs a real write() but does not mix with
+// the report.
+
+#define BENCH_MAX_RESULTS   64
+#define BENCH_ROUND_NS      20000000ull     // calibrate each round to ~20 ms
+#define BENCH_TRACE_ID      0x0123456789abcdefull
+
+static const size_t payload_sizes[] = {16, 1024, 65536};
+
+// ============== ALLOCATION COUNTING ==============
+// The executable's malloc() interposes the one in libc for json-c and libubox
+// too; glibc exports its implementation as __libc_*.
+static unsigned long alloc_count;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+#define BENCH_COUNTS_ALLOCS 1
+#else
+#define BENCH_COUNTS_ALLOCS 0
+#endif
+
+// ============== CYCLE COUNTER ==============
+static int cycles_fd = -1;
+static const char *cycles_source = "none";
+
+static void cycles_init(void)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CPU_CYCLES,
+        .exclude_hv = 1,
+    };
+
+    // Kernel cycles count too (log_format writes); fall back to user only
+    cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (cycles_fd < 0) {
+        attr.exclude_kernel = 1;
+        cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    if (cycles_fd >= 0) {
+        cycles_source = attr.exclude_kernel ? "perf (user)" : "perf";
+    } else {
+#if defined(__x86_64__) || defined(__i386__)
+        cycles_source = "tsc";
+#endif
+    }
+}
+
+static uint64_t cycles_now(void)
+{
+    if (cycles_fd >= 0) {
+        uint64_t v = 0;
+        if (read(cycles_fd, &v, sizeof(v)) == sizeof(v))
+            return v;
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ============== STAGES ==============
+struct bench_input {
+    size_t size;
+    char *name;             // 'size' bytes of payload
+    char *request_line;     // Direction A request as read from a client
+    size_t request_len;
+    char *server_reply;     // rpc_server reply line
+    size_t server_reply_len;
+    struct blob_buf reply_blob;     // ubus reply as delivered to the bridge
+};
+
+// Direction A: parse a client request and pick out its fields
+static void stage_request_parse(struct bench_input *in)
+{
+    struct rpc_request req;
+    struct greet_welcome_params params;
+
+    rpc_read_request(in->request_line, in->request_len, &req, &params);
+    rpc_request_free(&req);
+    greet_welcome_params_free(&params);
+}
+
+// Direction B: JSON-RPC request for rpc_server
+static void stage_request_build(struct bench_input *in)
+{
+    struct greet_welcome_params params = {
+        .name = in->name,
+        .present = GREET_WELCOME_PARAMS_HAS_NAME,
+    };
+    size_t len;
+    free(rpc_build_request(GREET_WELCOME_RPC, &params, 1, BENCH_TRACE_ID, &len));
+}
+
+// Direction B: rpc_greet_line_cb() parsing the rpc_server reply
+static void stage_reply_extract(struct bench_input *in)
+{
+    struct rpc_reply reply;
+    struct greet_welcome_result result;
+
+    rpc_read_reply(in->server_reply, in->server_reply_len, &reply, &result);
+    rpc_reply_free(&reply);
+    greet_welcome_result_free(&result);
+}
+
+// Direction B: ubus reply built from the extracted message
+static void stage_blobmsg_build(struct bench_input *in)
+{
+    struct greet_welcome_result result = {
+        .message = in->name,
+        .present = GREET_WELCOME_RESULT_HAS_MESSAGE,
+    };
+    struct blob_buf b = {};
+
+    blob_buf_init(&b, 0);
+    greet_welcome_result_to_blob(&b, &result);
+    blob_buf_free(&b);
+}
+
+// Direction A: ubus reply to a JSON-RPC reply line
+static void stage_reply_serialize(struct bench_input *in)
+{
+    char *result_json = rpc_result_json(in->reply_blob.head);
+    free(rpc_format_result(1, result_json));
+    free(result_json);
+}
+
+// One log.h line as written for every bridged request
+static void stage_log_format(struct bench_input *in)
+{
+    log_info("Direction A: RPC->ubus forwarding method='%s' name='%s'", "greet.welcome", in->name);
+}
+
+static const struct bench_stage {
+    const char *name;
+    void (*run)(struct bench_input *in);
+} stages[] = {
+    {"request_parse",   stage_request_parse},
+    {"request_build",   stage_request_build},
+    {"reply_extract",   stage_reply_extract},
+    {"blobmsg_build",   stage_blobmsg_build},
+    {"reply_serialize", stage_reply_serialize},
+    {"log_format",      stage_log_format},
+};
+
+static int input_init(struct bench_input *in, size_t size)
+{
+    memset(in, 0, sizeof(*in));
+    in->size = size;
+
+    in->name = malloc(size + 1);
+    in->request_line = malloc(size + 256);
+    in->server_reply = malloc(size + 256);
+    if (!in->name || !in->request_line || !in->server_reply)
+        return -1;
+
+    memset(in->name, 'x', size);
+    in->name[size] = '\0';
+
+    in->request_len = (size_t)snprintf(in->request_line, size + 256,
+        "{\"id\":1,\"method\":\"greet.welcome\",\"params\":{\"name\":\"%s\"},\"" RPC_TRACE_ID_KEY "\":\"%016llx\"}",
+        in->name, (unsigned long long)BENCH_TRACE_ID);
+    in->server_reply_len = (size_t)snprintf(in->server_reply, size + 256,
+        "{\"id\":1,\"result\":{\"message\":\"%s\"},\"error\":null}", in->name);
+
+    blob_buf_init(&in->reply_blob, 0);
+    blobmsg_add_string(&in->reply_blob, "message", in->name);
+    return 0;
+}
+
+static void input_free(struct bench_input *in)
+{
+    blob_buf_free(&in->reply_blob);
+    free(in->name);
+    free(in->request_line);
+    free(in->server_reply);
+}
+
+// ============== MEASUREMENT ==============
+struct bench_result {
+    char stage[32];
+    size_t size;
+    double ns_op;
+    double allocs_op;
+    double cycles_op;
+};
+
+static void bench_run(const struct bench_stage *st, struct bench_input *in, int rounds,
+                      struct bench_result *res)
+{
+    uint64_t iters = 1;
+
+    // Warm up and find an iteration count that fills one round
+    while (1) {
+        uint64_t t0 = now_ns();
+        for (uint64_t i = 0; i < iters; i++)
+            st->run(in);
+        if (now_ns() - t0 >= BENCH_ROUND_NS / 4 || iters >= (1ull << 30))
+            break;
+        iters *= 2;
+    }
+    iters *= 4;
+
+    snprintf(res->stage, sizeof(res->stage), "%s", st->name);
+    res->size = in->size;
+    res->ns_op = -1;
+
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a0 = alloc_count;
+        uint64_t c0 = cycles_now();
+        uint64_t t0 = now_ns();
+
+        for (uint64_t i = 0; i < iters; i++)
+            st->run(in);
+
+        uint64_t t1 = now_ns();
+        uint64_t c1 = cycles_now();
+        double ns_op = (double)(t1 - t0) / iters;
+
+        if (r == 0)
+            res->allocs_op = (double)(alloc_count - a0) / iters;
+        if (res->ns_op < 0 || ns_op < res->ns_op) {
+            res->ns_op = ns_op;
+            res->cycles_op = (double)(c1 - c0) / iters;
+        }
+    }
+}
+
+// ============== BASELINE ==============
+static int baseline_load(const char *path, struct bench_result *base, int max)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char line[256];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        struct bench_result *b = &base[n];
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%31s %zu %lf %lf %lf", b->stage, &b->size,
+                   &b->ns_op, &b->allocs_op, &b->cycles_op) == 5)
+            n++;
+    }
+
+    fclose(f);
+    return n;
+}
+
+static int baseline_write(const char *path, const struct bench_result *res, int n)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    fprintf(f, "# bridge_microbench baseline (cycles: %s)\n", cycles_source);
+    fprintf(f, "# stage size ns_per_op allocs_per_op cycles_per_op\n");
+    for (int i = 0; i < n; i++)
+        fprintf(f, "%s %zu %.1f %.2f %.1f\n", res[i].stage, res[i].size,
+                res[i].ns_op, res[i].allocs_op, res[i].cycles_op);
+
+    return fclose(f);
+}
+
+static const struct bench_result *baseline_find(const struct bench_result *base, int n,
+                                                const struct bench_result *r)
+{
+    for (int i = 0; i < n; i++) {
+        if (base[i].size == r->size && strcmp(base[i].stage, r->stage) == 0)
+            return &base[i];
+    }
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-b baseline] [-w baseline] [-t pct] [-r rounds] [-f filter]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *baseline_path = NULL;
+    const char *write_path = NULL;
+    const char *filter = NULL;
+    const char *env_threshold = getenv("MICROBENCH_THRESHOLD");
+    double threshold = env_threshold ? atof(env_threshold) : 15.0;
+    int rounds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:t:r:f:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 'w':
+            write_path = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // Without a baseline nothing is compared, so a gate would always pass
+    struct bench_result base[BENCH_MAX_RESULTS];
+    int nbase = baseline_path ? baseline_load(baseline_path, base, BENCH_MAX_RESULTS) : -1;
+    const char *allow_missing = getenv("MICROBENCH_ALLOW_MISSING");
+    if (baseline_path && nbase <= 0 && !(allow_missing && strcmp(allow_missing, "1") == 0)) {
+        fprintf(stderr, "bridge_microbench: no baseline at %s; run 'make microbench-baseline' "
+                "to create one, or set MICROBENCH_ALLOW_MISSING=1 to report only\n", baseline_path);
+        return 2;
+    }
+
+    // Report on the original stdout; the measured code logs into /dev/null
+    fflush(stdout);
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    if (!report || devnull < 0) {
+        perror("bridge_microbench");
+        return 2;
+    }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    cycles_init();
+
+    struct bench_result results[BENCH_MAX_RESULTS];
+    int nres = 0;
+
+    for (size_t s = 0; s < sizeof(payload_sizes) / sizeof(payload_sizes[0]); s++) {
+        struct bench_input in;
+        if (input_init(&in, payload_sizes[s]) < 0) {
+            fprintf(stderr, "bridge_microbench: out of memory\n");
+            return 2;
+        }
+
+        for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]) && nres < BENCH_MAX_RESULTS; i++) {
+            if (filter && !strstr(stages[i].name, filter))
+                continue;
+            bench_run(&stages[i], &in, rounds, &results[nres++]);
+        }
+
+        input_free(&in);
+    }
+
+    int regressions = 0;
+
+    fprintf(report, "cycles: %s, allocations: %s, threshold: %.1f%%\n", cycles_source,
+            BENCH_COUNTS_ALLOCS ? "counted" : "not counted", threshold);
+    if (baseline_path && nbase <= 0)
+        fprintf(report, "no baseline at %s, reporting only\n", baseline_path);
+
+    fprintf(report, "%-16s %6s %12s %10s %12s %12s %8s\n",
+            "stage", "size", "ns/op", "allocs/op", "cycles/op", "base ns/op", "delta");
+
+    for (int i = 0; i < nres; i++) {
+        const struct bench_result *r = &results[i];
+        const struct bench_result *b = nbase > 0 ? baseline_find(base, nbase, r) : NULL;
+
+        fprintf(report, "%-16s %6zu %12.1f %10.2f %12.1f", r->stage, r->size,
+                r->ns_op, r->allocs_op, r->cycles_op);
+        if (!b) {
+            fprintf(report, " %12s %8s\n", "-", "-");
+            continue;
+        }
+
+        double delta = b->ns_op > 0 ? (r->ns_op - b->ns_op) * 100.0 / b->ns_op : 0;
+        bool slower = delta > threshold;
+        bool more_allocs = BENCH_COUNTS_ALLOCS && r->allocs_op > b->allocs_op + 0.5;
+
+        fprintf(report, " %12.1f %+7.1f%%%s%s\n", b->ns_op, delta,
+                slower ? "  REGRESSED" : "", more_allocs ? "  MORE ALLOCS" : "");
+        if (slower || more_allocs)
+            regressions++;
+    }
+
+    if (write_path) {
+        if (baseline_write(write_path, results, nres) < 0) {
+            fprintf(stderr, "bridge_microbench: cannot write %s\n", write_path);
+            return 2;
+        }
+        fprintf(report, "baseline written to %s\n", write_path);
+    }
+
+    if (regressions)
+        fprintf(report, "%d stage(s) regressed beyond %.1f%%\n", regressions, threshold);
+
+    fclose(report);
+    return regressions ? 1 : 0;
+}
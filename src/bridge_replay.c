@@ -0,0 +1,585 @@
+/*
+ * Replays a traffic capture (RPC_CAPTURE_FILE of ubus_rpc_bridge) against a
+ * running bridge and compares replies and latency distributions.
+ *
+ *   bridge_replay [-s 1|N|max] [-c window] [-d A|B] [-o object] [-v] capture.bin
+ *
+ *   -s  replay speed: 1 = original pacing (default), N = N times faster,
+ *       max = as fast as the window allows
+ *   -c  records in flight at most (default 256)
+ *   -d  only replay one direction
+ *   -o  ubus object for Direction B records (default: from the capture)
+ *   -v  print every mismatching reply
+ *
+ * Direction A records are sent to /tmp/bridge_rpc.sock, Direction B records
+ * are invoked on ubus. Each record is issued at its scheduled time on its own
+ * connection (or ubus request) without waiting for earlier replies, so slow
+ * replies overlap as they did when the traffic was recorded. Only when the
+ * window is full is a record sent late; late records are counted.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <json-c/json.h>
+#include <libubus.h>
+#include <libubox/blobmsg_json.h>
+#include "log.h"
+#include "rpc_protocol.h"
+#include "trace.h"
+#include "capture.h"
+
+#define REPLAY_TIMEOUT_MS       3000
+#define REPLAY_WINDOW_DEFAULT   256
+#define REPLAY_LATE_NS          2000000ull     // uloop timers have 1ms resolution
+
+struct latency_set {
+    uint64_t *ns;
+    size_t count;
+    size_t cap;
+};
+
+static struct ubus_context *ubus_ctx;
+
+static void latency_add(struct latency_set *set, uint64_t ns)
+{
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 1024;
+        uint64_t *ns_new = realloc(set->ns, cap * sizeof(*ns_new));
+        if (!ns_new)
+            return;
+        set->ns = ns_new;
+        set->cap = cap;
+    }
+    set->ns[set->count++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const struct latency_set *set, double p)
+{
+    if (!set->count)
+        return 0.0;
+    size_t idx = (size_t)(p * (double)(set->count - 1) + 0.5);
+    return (double)set->ns[idx] / 1000.0;
+}
+
+static void print_distribution(const char *label, struct latency_set *set)
+{
+    qsort(set->ns, set->count, sizeof(*set->ns), cmp_u64);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < set->count; i++)
+        sum += (double)set->ns[i];
+
+    printf("  %-9s n=%-7zu mean=%9.1f p50=%9.1f p90=%9.1f p99=%9.1f p99.9=%9.1f max=%9.1f us\n",
+           label, set->count,
+           set->count ? sum / (double)set->count / 1000.0 : 0.0,
+           percentile_us(set, 0.50), percentile_us(set, 0.90),
+           percentile_us(set, 0.99), percentile_us(set, 0.999),
+           percentile_us(set, 1.0));
+}
+
+// Compare replies ignoring trailing whitespace (line terminators); a missing
+// reply equals an empty one
+static int reply_equal(const char *a, const char *b)
+{
+    if (!a)
+        a = "";
+    if (!b)
+        b = "";
+
+    size_t la = strlen(a), lb = strlen(b);
+    while (la && (a[la - 1] == '\n' || a[la - 1] == '\r' || a[la - 1] == ' '))
+        la--;
+    while (lb && (b[lb - 1] == '\n' || b[lb - 1] == '\r' || b[lb - 1] == ' '))
+        lb--;
+    return la == lb && memcmp(a, b, la) == 0;
+}
+
+// ============== REPLAY STATE ==============
+// One in-flight replayed record. Direction A uses the socket and its buffers,
+// Direction B the ubus request and the reply parts.
+struct replay_req {
+    struct capture_record rec;
+    uint64_t start_ns;
+    struct uloop_timeout timer;
+
+    struct uloop_fd fd;
+    char *out;
+    size_t out_len;
+    size_t out_off;
+    char *in;
+    size_t in_len;
+    size_t in_cap;
+    size_t line_start;
+
+    struct ubus_request ureq;
+    struct blob_buf params;
+    struct capture_parts parts;
+};
+
+static struct {
+    FILE *fp;
+    double speed;               // 0 = as fast as the window allows
+    int only_dir;
+    const char *object_override;
+    bool verbose;
+    unsigned int window;        // records in flight at most
+    unsigned int inflight;
+    bool eof;
+    int read_error;
+
+    struct uloop_timeout pacer;
+    struct capture_record next;
+    bool have_next;
+    bool started;
+    uint64_t start_ns;
+    uint64_t first_arrival;
+
+    struct latency_set recorded[2];
+    struct latency_set replayed[2];
+    unsigned long sent[2];
+    unsigned long streamed[2];
+    unsigned long failed[2];
+    unsigned long mismatched[2];
+    unsigned long late;
+} replay = {
+    .speed = 1.0,
+    .window = REPLAY_WINDOW_DEFAULT,
+};
+
+static void replay_pace(struct uloop_timeout *t);
+
+// Tally a finished record and release it; 'reply' is NULL when it failed
+static void replay_finish(struct replay_req *req, const char *reply, int status)
+{
+    const struct capture_record *rec = &req->rec;
+    int slot = rec->hdr.direction == CAPTURE_DIR_B;
+
+    uloop_timeout_cancel(&req->timer);
+
+    replay.sent[slot]++;
+    if (rec->hdr.flags & CAPTURE_F_STREAMED)
+        replay.streamed[slot]++;
+    latency_add(&replay.recorded[slot], rec->hdr.latency_ns);
+
+    if (!reply) {
+        replay.failed[slot]++;
+    } else {
+        latency_add(&replay.replayed[slot], trace_now_ns() - req->start_ns);
+        if (status != rec->hdr.status || !reply_equal(reply, rec->reply)) {
+            replay.mismatched[slot]++;
+            if (replay.verbose) {
+                printf("mismatch (%c, %s):\n  recorded: [%d] %s\n  replayed: [%d] %s\n",
+                       rec->hdr.direction, rec->method, rec->hdr.status, rec->reply,
+                       status, reply);
+            }
+        }
+    }
+
+    if (req->fd.fd >= 0) {
+        uloop_fd_delete(&req->fd);
+        close(req->fd.fd);
+    }
+    free(req->out);
+    free(req->in);
+    blob_buf_free(&req->params);
+    capture_parts_free(&req->parts);
+    capture_record_free(&req->rec);
+    free(req);
+
+    // A slot in the window opened up
+    replay.inflight--;
+    if (!replay.pacer.pending)
+        uloop_timeout_set(&replay.pacer, 0);
+}
+
+static void replay_timeout_cb(struct uloop_timeout *t)
+{
+    struct replay_req *req = container_of(t, struct replay_req, timer);
+
+    log_error("replay: %s got no reply within %dms", req->rec.method, REPLAY_TIMEOUT_MS);
+    if (req->rec.hdr.direction == CAPTURE_DIR_B)
+        ubus_abort_request(ubus_ctx, &req->ureq);
+    replay_finish(req, NULL, 0);
+}
+
+// ============== DIRECTION A: replay over the bridge socket ==============
+// Status as the capture records it for Direction A: -1 for an error reply
+static int reply_status(const char *reply)
+{
+    json_object *obj = reply ? json_tokener_parse(reply) : NULL;
+    json_object *error = NULL;
+    int status = 0;
+
+    // A JSON null member is a NULL object in json-c
+    if (obj && json_object_object_get_ex(obj, "error", &error) && error)
+        status = -1;
+    json_object_put(obj);
+    return status;
+}
+
+// A partial frame of a streamed reply, as opposed to the final frame
+static bool frame_is_partial(const char *line, size_t len)
+{
+    json_tokener *tok = json_tokener_new();
+    json_object *obj = tok ? json_tokener_parse_ex(tok, line, (int)len) : NULL;
+    bool partial = obj && json_object_object_get_ex(obj, RPC_PARTIAL_KEY, NULL);
+
+    json_object_put(obj);
+    if (tok)
+        json_tokener_free(tok);
+    return partial;
+}
+
+static int replay_bridge_flush(struct replay_req *req)
+{
+    while (req->out_off < req->out_len) {
+        ssize_t n = write(req->fd.fd, req->out + req->out_off, req->out_len - req->out_off);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        req->out_off += n;
+    }
+    return 0;
+}
+
+// The whole reply is read: any partial frames and the final frame, as
+// recorded by the capture. Latency is to the final frame.
+static void replay_bridge_fd_cb(struct uloop_fd *ufd, unsigned int events)
+{
+    struct replay_req *req = container_of(ufd, struct replay_req, fd);
+
+    if (req->out_off < req->out_len) {
+        if (replay_bridge_flush(req) < 0) {
+            log_error("replay: write to %s failed: %s", BRIDGE_SOCK_PATH, strerror(errno));
+            replay_finish(req, NULL, 0);
+            return;
+        }
+        if (req->out_off < req->out_len)
+            return;
+        uloop_fd_add(&req->fd, ULOOP_READ);
+    }
+
+    if (!(events & ULOOP_READ))
+        return;
+
+    while (1) {
+        if (req->in_cap - req->in_len < 2048) {
+            size_t cap = req->in_cap ? req->in_cap * 2 : 4096;
+            char *grown = realloc(req->in, cap);
+            if (!grown) {
+                replay_finish(req, NULL, 0);
+                return;
+            }
+            req->in = grown;
+            req->in_cap = cap;
+        }
+
+        ssize_t n = read(req->fd.fd, req->in + req->in_len, req->in_cap - req->in_len - 1);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            replay_finish(req, NULL, 0);
+            return;
+        }
+        if (n == 0)
+            break;      // the bridge closed: take what arrived as the reply
+        req->in_len += n;
+
+        char *nl;
+        bool final = false;
+        while (!final && (nl = memchr(req->in + req->line_start, '\n',
+                                      req->in_len - req->line_start))) {
+            final = !frame_is_partial(req->in + req->line_start, nl - (req->in + req->line_start));
+            if (!final)
+                req->line_start = nl + 1 - req->in;
+        }
+        if (final)
+            break;
+    }
+
+    req->in[req->in_len] = '\0';
+    if (!req->in_len) {
+        replay_finish(req, NULL, 0);
+        return;
+    }
+    replay_finish(req, req->in, reply_status(req->in + req->line_start));
+}
+
+static int replay_bridge(struct replay_req *req)
+{
+    const struct capture_record *rec = &req->rec;
+    size_t len = rec->hdr.payload_len;
+
+    req->out = malloc(len + 1);
+    if (!req->out)
+        return -1;
+    memcpy(req->out, rec->payload, len);
+    if (!len || rec->payload[len - 1] != '\n')
+        req->out[len++] = '\n';
+    req->out_len = len;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, BRIDGE_SOCK_PATH, sizeof(addr.sun_path) - 1);
+
+    // AF_UNIX connect completes immediately or fails (EAGAIN = backlog full)
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        log_error("replay: connect(%s) failed: %s", BRIDGE_SOCK_PATH, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    req->fd.fd = fd;
+    req->fd.cb = replay_bridge_fd_cb;
+
+    if (replay_bridge_flush(req) < 0) {
+        log_error("replay: write to %s failed: %s", BRIDGE_SOCK_PATH, strerror(errno));
+        return -1;
+    }
+    uloop_fd_add(&req->fd, req->out_off < req->out_len ? ULOOP_WRITE : ULOOP_READ);
+    return 0;
+}
+
+// ============== DIRECTION B: replay over ubus ==============
+// Every reply message is kept, one per line, as the capture records a streamed reply
+static void replay_ubus_data_cb(struct ubus_request *ureq, int type, struct blob_attr *msg)
+{
+    (void)type;
+    struct replay_req *req = ureq->priv;
+    char *json = msg ? blobmsg_format_json(msg, true) : NULL;
+
+    if (json)
+        capture_parts_add(&req->parts, json, strlen(json));
+    free(json);
+}
+
+static void replay_ubus_complete_cb(struct ubus_request *ureq, int ret)
+{
+    struct replay_req *req = ureq->priv;
+
+    replay_finish(req, req->parts.data ? req->parts.data : "", ret);
+}
+
+static int replay_ubus(struct replay_req *req)
+{
+    if (!ubus_ctx) {
+        ubus_ctx = ubus_connect(NULL);
+        if (!ubus_ctx) {
+            log_error("replay: failed to connect to ubus daemon");
+            return -1;
+        }
+        ubus_add_uloop(ubus_ctx);
+    }
+
+    // method is recorded as "object.method"
+    char *dot = strrchr(req->rec.method, '.');
+    char object[256];
+    const char *method = dot ? dot + 1 : req->rec.method;
+
+    snprintf(object, sizeof(object), "%.*s",
+             (int)(dot ? (size_t)(dot - req->rec.method) : strlen(req->rec.method)),
+             req->rec.method);
+
+    uint32_t obj_id;
+    if (ubus_lookup_id(ubus_ctx, replay.object_override ? replay.object_override : object,
+                       &obj_id)) {
+        log_error("replay: ubus object '%s' not found",
+                  replay.object_override ? replay.object_override : object);
+        return -1;
+    }
+
+    blob_buf_init(&req->params, 0);
+    if (*req->rec.payload && !blobmsg_add_json_from_string(&req->params, req->rec.payload)) {
+        log_error("replay: cannot convert payload to blobmsg: %s", req->rec.payload);
+        return -1;
+    }
+
+    if (ubus_invoke_async(ubus_ctx, obj_id, method, req->params.head, &req->ureq))
+        return -1;
+    req->ureq.data_cb = replay_ubus_data_cb;
+    req->ureq.complete_cb = replay_ubus_complete_cb;
+    req->ureq.priv = req;
+    ubus_complete_request_async(ubus_ctx, &req->ureq);
+    return 0;
+}
+
+// ============== PACING ==============
+// Next record to replay, skipping other directions: 1 = read, 0 = end, -1 = error
+static int replay_read_next(void)
+{
+    int ret;
+
+    while ((ret = capture_read(replay.fp, &replay.next)) == 1) {
+        int dir = replay.next.hdr.direction;
+        if ((dir == CAPTURE_DIR_A || dir == CAPTURE_DIR_B) &&
+            (!replay.only_dir || dir == replay.only_dir))
+            return 1;
+        capture_record_free(&replay.next);
+    }
+    return ret;
+}
+
+static void replay_issue(struct capture_record *rec)
+{
+    struct replay_req *req = calloc(1, sizeof(*req));
+
+    if (!req) {
+        replay.failed[rec->hdr.direction == CAPTURE_DIR_B]++;
+        capture_record_free(rec);
+        return;
+    }
+    req->rec = *rec;
+    req->fd.fd = -1;
+    req->timer.cb = replay_timeout_cb;
+    req->start_ns = trace_now_ns();
+    replay.inflight++;
+
+    int ret = req->rec.hdr.direction == CAPTURE_DIR_A ? replay_bridge(req) : replay_ubus(req);
+    if (ret < 0) {
+        replay_finish(req, NULL, 0);
+        return;
+    }
+    uloop_timeout_set(&req->timer, REPLAY_TIMEOUT_MS);
+}
+
+// Issue every record that is due, as long as the window has room. Records go
+// out at 'start + (arrival - first arrival) / speed' whether or not earlier
+// replies are back; they fall behind only when the window is full.
+static void replay_pace(struct uloop_timeout *t)
+{
+    while (replay.inflight < replay.window) {
+        if (!replay.have_next) {
+            if (replay.eof)
+                break;
+            int ret = replay_read_next();
+            if (ret <= 0) {
+                replay.eof = true;
+                replay.read_error = ret < 0;
+                break;
+            }
+            replay.have_next = true;
+        }
+
+        uint64_t now = trace_now_ns();
+        if (!replay.started) {
+            replay.started = true;
+            replay.start_ns = now;
+            replay.first_arrival = replay.next.hdr.arrival_ns;
+        }
+
+        if (replay.speed > 0.0) {
+            uint64_t due = replay.start_ns +
+                (uint64_t)((double)(replay.next.hdr.arrival_ns - replay.first_arrival) / replay.speed);
+            if (due > now) {
+                uloop_timeout_set(t, (int)((due - now + 999999) / 1000000));
+                return;
+            }
+            if (now - due > REPLAY_LATE_NS)
+                replay.late++;
+        }
+
+        replay.have_next = false;
+        replay_issue(&replay.next);
+    }
+
+    if (replay.eof && !replay.inflight)
+        uloop_end();
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s 1|N|max] [-c window] [-d A|B] [-o object] [-v] capture.bin\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *speed_str = "1";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:d:o:vh")) != -1) {
+        switch (opt) {
+        case 's':
+            speed_str = optarg;
+            replay.speed = strcmp(optarg, "max") == 0 ? 0.0 : strtod(optarg, NULL);
+            if (replay.speed < 0.0 || (replay.speed == 0.0 && strcmp(optarg, "max") != 0)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            replay.window = (unsigned int)strtoul(optarg, NULL, 10);
+            if (!replay.window) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            replay.only_dir = optarg[0];
+            break;
+        case 'o':
+            replay.object_override = optarg;
+            break;
+        case 'v':
+            replay.verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    replay.fp = capture_open(argv[optind], NULL);
+    if (!replay.fp)
+        return 1;
+
+    log_info("Replaying %s at %s%s speed, up to %u in flight", argv[optind], speed_str,
+             replay.speed > 0.0 ? "x" : "", replay.window);
+
+    uloop_init();
+    replay.pacer.cb = replay_pace;
+    uloop_timeout_set(&replay.pacer, 0);
+    uloop_run();
+    uloop_done();
+
+    fclose(replay.fp);
+    if (ubus_ctx)
+        ubus_free(ubus_ctx);
+
+    for (int slot = 0; slot < 2; slot++) {
+        if (!replay.sent[slot])
+            continue;
+        printf("Direction %c: %lu sent (%lu streamed), %lu failed, %lu mismatched replies\n",
+               slot ? 'B' : 'A', replay.sent[slot], replay.streamed[slot],
+               replay.failed[slot], replay.mismatched[slot]);
+        print_distribution("recorded", &replay.recorded[slot]);
+        print_distribution("replayed", &replay.replayed[slot]);
+        free(replay.recorded[slot].ns);
+        free(replay.replayed[slot].ns);
+    }
+    if (replay.late)
+        printf("%lu records sent more than %llums behind schedule\n", replay.late,
+               (unsigned long long)(REPLAY_LATE_NS / 1000000));
+
+    return replay.read_error ? 1 : 0;
+}
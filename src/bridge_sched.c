@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "log.h"
+#include "trace.h"
+#include "bridge_sched.h"
+
+#define SCHED_METHOD_LIST_LEN 256
+
+struct sched_queue {
+    const char *name;
+    unsigned int weight;
+    unsigned int max_inflight;
+    unsigned int inflight;
+    int deficit;
+    struct list_head queue;
+    unsigned int queued;
+
+    unsigned long dispatched;
+    unsigned long cancelled;
+    uint64_t max_wait_ns;
+};
+
+static struct sched_queue classes[__SCHED_CLASS_MAX] = {
+    [SCHED_CONTROL]     = {.name = "control",     .weight = 0, .max_inflight = 4},
+    [SCHED_INTERACTIVE] = {.name = "interactive", .weight = 4, .max_inflight = 12},
+    [SCHED_BULK]        = {.name = "bulk",        .weight = 1, .max_inflight = 4},
+};
+
+static unsigned int max_inflight = 16;
+static unsigned int total_inflight;
+static unsigned int rr_cursor = SCHED_INTERACTIVE;
+
+static char control_methods[SCHED_METHOD_LIST_LEN] = "rpc.*,system.*";
+static char bulk_methods[SCHED_METHOD_LIST_LEN] = "";
+
+static bool dispatching;
+static bool dispatch_again;
+
+static void load_class(const char *env_name, struct sched_queue *q)
+{
+    const char *val = getenv(env_name);
+    if (!val || !*val)
+        return;
+
+    // "weight,max_inflight"; either part may be left empty
+    char *end = NULL;
+    unsigned long weight = strtoul(val, &end, 10);
+    if (end != val)
+        q->weight = (unsigned int)weight;
+    if (*end == ',') {
+        unsigned long limit = strtoul(end + 1, NULL, 10);
+        if (limit)
+            q->max_inflight = (unsigned int)limit;
+    }
+}
+
+static void load_list(const char *env_name, char *dst)
+{
+    const char *val = getenv(env_name);
+    if (val)
+        snprintf(dst, SCHED_METHOD_LIST_LEN, "%s", val);
+}
+
+void sched_init(void)
+{
+    const char *val = getenv("RPC_SCHED_MAX_INFLIGHT");
+    if (val && strtoul(val, NULL, 10) > 0)
+        max_inflight = (unsigned int)strtoul(val, NULL, 10);
+
+    load_class("RPC_SCHED_CONTROL", &classes[SCHED_CONTROL]);
+    load_class("RPC_SCHED_INTERACTIVE", &classes[SCHED_INTERACTIVE]);
+    load_class("RPC_SCHED_BULK", &classes[SCHED_BULK]);
+    load_list("RPC_SCHED_CONTROL_METHODS", control_methods);
+    load_list("RPC_SCHED_BULK_METHODS", bulk_methods);
+
+    for (int i = 0; i < __SCHED_CLASS_MAX; i++) {
+        INIT_LIST_HEAD(&classes[i].queue);
+        if (i != SCHED_CONTROL && !classes[i].weight)
+            classes[i].weight = 1;
+    }
+    // The class under the cursor starts with its quantum; the others get theirs
+    // when the cursor reaches them
+    classes[rr_cursor].deficit = (int)classes[rr_cursor].weight;
+
+    log_debug("sched: max_inflight=%u interactive=%u/%u bulk=%u/%u control=strict/%u",
+              max_inflight,
+              classes[SCHED_INTERACTIVE].weight, classes[SCHED_INTERACTIVE].max_inflight,
+              classes[SCHED_BULK].weight, classes[SCHED_BULK].max_inflight,
+              classes[SCHED_CONTROL].max_inflight);
+}
+
+const char *sched_class_name(enum sched_class cls)
+{
+    return cls < __SCHED_CLASS_MAX ? classes[cls].name : "unknown";
+}
+
+static bool method_in_list(const char *method, const char *list)
+{
+    size_t mlen = strlen(method);
+
+    while (*list) {
+        const char *sep = strchr(list, ',');
+        size_t len = sep ? (size_t)(sep - list) : strlen(list);
+
+        if (len && list[len - 1] == '*') {
+            if (mlen >= len - 1 && strncmp(method, list, len - 1) == 0)
+                return true;
+        } else if (len == mlen && strncmp(method, list, len) == 0) {
+            return true;
+        }
+
+        if (!sep)
+            break;
+        list = sep + 1;
+    }
+
+    return false;
+}
+
+enum sched_class sched_classify(const char *method, bool from_ubus, int peer_uid)
+{
+    bool trusted = from_ubus || peer_uid == 0;
+
+    // The strict-priority lane is never open to an unprivileged client
+    if (trusted && method && method_in_list(method, control_methods))
+        return SCHED_CONTROL;
+    if (method && method_in_list(method, bulk_methods))
+        return SCHED_BULK;
+    if (trusted)
+        return SCHED_INTERACTIVE;
+    return SCHED_BULK;
+}
+
+static bool can_run(const struct sched_queue *q)
+{
+    return q->queued && q->inflight < q->max_inflight && total_inflight < max_inflight;
+}
+
+static void run_one(struct sched_queue *q)
+{
+    struct sched_job *job = list_first_entry(&q->queue, struct sched_job, list);
+
+    list_del_init(&job->list);
+    job->queued = false;
+    if (!--q->queued)
+        q->deficit = 0;     // no credit is kept while idle
+    q->inflight++;
+    q->dispatched++;
+    total_inflight++;
+
+    job->dispatch_ns = trace_now_ns();
+    if (job->dispatch_ns - job->enqueue_ns > q->max_wait_ns)
+        q->max_wait_ns = job->dispatch_ns - job->enqueue_ns;
+
+    job->run(job);  // may call sched_done() before returning
+}
+
+static unsigned int next_weighted(unsigned int cls)
+{
+    return cls + 1 < __SCHED_CLASS_MAX ? cls + 1 : SCHED_INTERACTIVE;
+}
+
+// Deficit round robin: the class under the cursor keeps its turn while it has
+// credit. Moving the cursor adds a quantum (its weight) to the next class if it
+// can run; credit left over because of an in-flight limit is carried to its
+// next turn. A class loses its credit only when its queue empties.
+static struct sched_queue *drr_pick(void)
+{
+    if (total_inflight >= max_inflight)
+        return NULL;
+
+    for (int tries = 0; tries <= 2 * (__SCHED_CLASS_MAX - SCHED_INTERACTIVE); tries++) {
+        struct sched_queue *q = &classes[rr_cursor];
+
+        if (q->deficit > 0 && can_run(q))
+            return q;
+
+        rr_cursor = next_weighted(rr_cursor);
+        q = &classes[rr_cursor];
+        if (can_run(q))
+            q->deficit += (int)q->weight;
+    }
+
+    return NULL;
+}
+
+static void sched_dispatch(void)
+{
+    struct sched_queue *ctl = &classes[SCHED_CONTROL];
+
+    while (1) {
+        // Strict-priority lane first
+        if (can_run(ctl)) {
+            run_one(ctl);
+            continue;
+        }
+
+        struct sched_queue *q = drr_pick();
+        if (!q)
+            break;
+
+        q->deficit--;
+        run_one(q);
+    }
+}
+
+// Dispatching can recurse through job->run() -> sched_done(); flatten it
+static void sched_kick(void)
+{
+    if (dispatching) {
+        dispatch_again = true;
+        return;
+    }
+
+    dispatching = true;
+    do {
+        dispatch_again = false;
+        sched_dispatch();
+    } while (dispatch_again);
+    dispatching = false;
+}
+
+void sched_submit(struct sched_job *job, enum sched_class cls, sched_run_t run)
+{
+    struct sched_queue *q = &classes[cls < __SCHED_CLASS_MAX ? cls : SCHED_BULK];
+
+    job->cls = cls < __SCHED_CLASS_MAX ? cls : SCHED_BULK;
+    job->run = run;
+    job->enqueue_ns = trace_now_ns();
+    job->dispatch_ns = 0;
+    job->queued = true;
+    list_add_tail(&job->list, &q->queue);
+    q->queued++;
+
+    sched_kick();
+}
+
+bool sched_cancel(struct sched_job *job)
+{
+    if (!job->queued)
+        return false;
+
+    struct sched_queue *q = &classes[job->cls];
+
+    list_del_init(&job->list);
+    job->queued = false;
+    q->cancelled++;
+    if (!--q->queued)
+        q->deficit = 0;
+    return true;
+}
+
+void sched_done(struct sched_job *job)
+{
+    struct sched_queue *q = &classes[job->cls];
+
+    if (q->inflight)
+        q->inflight--;
+    if (total_inflight)
+        total_inflight--;
+
+    sched_kick();
+}
+
+void sched_stats(struct blob_buf *b)
+{
+    void *tbl = blobmsg_open_table(b, "scheduler");
+
+    blobmsg_add_u32(b, "max_inflight", max_inflight);
+    blobmsg_add_u32(b, "inflight", total_inflight);
+
+    for (int i = 0; i < __SCHED_CLASS_MAX; i++) {
+        const struct sched_queue *q = &classes[i];
+        void *cls = blobmsg_open_table(b, q->name);
+
+        blobmsg_add_u32(b, "weight", q->weight);
+        blobmsg_add_u32(b, "max_inflight", q->max_inflight);
+        blobmsg_add_u32(b, "inflight", q->inflight);
+        blobmsg_add_u32(b, "queued", q->queued);
+        blobmsg_add_u64(b, "dispatched", q->dispatched);
+        blobmsg_add_u64(b, "cancelled", q->cancelled);
+        blobmsg_add_u64(b, "max_wait_us", q->max_wait_ns / 1000);
+
+        blobmsg_close_table(b, cls);
+    }
+
+    blobmsg_close_table(b, tbl);
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "log.h"
+#include "trace.h"
+#include "capture.h"
+
+#define CAPTURE_BUF_SIZE (256 * 1024)
+
+static FILE *capture_fp;
+static char *capture_buf;
+static uint64_t capture_start_ns;
+static unsigned long capture_count;
+
+int capture_init(void)
+{
+    const char *path = getenv(CAPTURE_ENV_FILE);
+    if (!path || !*path)
+        return 0;
+
+    capture_fp = fopen(path, "wb");
+    if (!capture_fp) {
+        log_error("capture: cannot open %s, capture disabled", path);
+        return -1;
+    }
+
+    // Large stdio buffer: records are appended with plain fwrite() and only
+    // reach the kernel when the buffer fills or capture_flush() runs
+    capture_buf = malloc(CAPTURE_BUF_SIZE);
+    if (capture_buf)
+        setvbuf(capture_fp, capture_buf, _IOFBF, CAPTURE_BUF_SIZE);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t start_realtime = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    capture_start_ns = trace_now_ns();
+
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, capture_fp);
+    fwrite(&start_realtime, sizeof(start_realtime), 1, capture_fp);
+
+    log_info("capture: recording traffic to %s", path);
+    return 0;
+}
+
+bool capture_enabled(void)
+{
+    return capture_fp != NULL;
+}
+
+void capture_record(enum capture_dir dir, const char *method,
+                    const char *payload, size_t payload_len,
+                    const char *reply, size_t reply_len,
+                    int status, uint64_t arrival_ns, uint64_t latency_ns, bool streamed)
+{
+    if (!capture_fp)
+        return;
+
+    // The record header holds 32-bit lengths; a truncated body would desync the file
+    if ((payload && payload_len > UINT32_MAX) || (reply && reply_len > UINT32_MAX)) {
+        log_warn("capture: %s record too large (%zu/%zu bytes), not recorded",
+                 method ? method : "?", payload_len, reply_len);
+        return;
+    }
+
+    size_t method_len = method ? strlen(method) : 0;
+    struct capture_hdr hdr = {
+        .direction = (uint8_t)dir,
+        .flags = streamed ? CAPTURE_F_STREAMED : 0,
+        .method_len = (uint16_t)(method_len > UINT16_MAX ? UINT16_MAX : method_len),
+        .payload_len = payload ? (uint32_t)payload_len : 0,
+        .reply_len = reply ? (uint32_t)reply_len : 0,
+        .status = status,
+        .arrival_ns = arrival_ns > capture_start_ns ? arrival_ns - capture_start_ns : 0,
+        .latency_ns = latency_ns,
+    };
+
+    fwrite(&hdr, sizeof(hdr), 1, capture_fp);
+    if (hdr.method_len)
+        fwrite(method, 1, hdr.method_len, capture_fp);
+    if (hdr.payload_len)
+        fwrite(payload, 1, hdr.payload_len, capture_fp);
+    if (hdr.reply_len)
+        fwrite(reply, 1, hdr.reply_len, capture_fp);
+
+    capture_count++;
+}
+
+void capture_parts_add(struct capture_parts *parts, const char *data, size_t len)
+{
+    bool nl = len && data[len - 1] == '\n';
+    char *grown = realloc(parts->data, parts->len + len + !nl + 1);
+
+    if (!grown)
+        return;
+    memcpy(grown + parts->len, data, len);
+    parts->len += len;
+    if (!nl)
+        grown[parts->len++] = '\n';
+    grown[parts->len] = '\0';
+    parts->data = grown;
+    parts->count++;
+}
+
+void capture_parts_free(struct capture_parts *parts)
+{
+    free(parts->data);
+    memset(parts, 0, sizeof(*parts));
+}
+
+void capture_flush(void)
+{
+    if (capture_fp)
+        fflush(capture_fp);
+}
+
+void capture_shutdown(void)
+{
+    if (!capture_fp)
+        return;
+
+    fclose(capture_fp);
+    capture_fp = NULL;
+    free(capture_buf);
+    capture_buf = NULL;
+    log_info("capture: %lu records written", capture_count);
+}
+
+FILE *capture_open(const char *path, uint64_t *start_realtime_ns)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        log_error("capture: cannot open %s", path);
+        return NULL;
+    }
+
+    char magic[CAPTURE_MAGIC_LEN];
+    uint64_t start = 0;
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+        memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0 ||
+        fread(&start, sizeof(start), 1, fp) != 1) {
+        log_error("capture: %s is not a bridge capture file", path);
+        fclose(fp);
+        return NULL;
+    }
+
+    if (start_realtime_ns)
+        *start_realtime_ns = start;
+    return fp;
+}
+
+static char *read_field(FILE *fp, size_t len)
+{
+    char *buf = malloc(len + 1);
+    if (!buf)
+        return NULL;
+
+    if (len && fread(buf, 1, len, fp) != len) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+int capture_read(FILE *fp, struct capture_record *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+
+    size_t n = fread(&rec->hdr, 1, sizeof(rec->hdr), fp);
+    if (n == 0 && feof(fp))
+        return 0;
+    if (n != sizeof(rec->hdr)) {
+        log_error("capture: truncated record header");
+        return -1;
+    }
+
+    rec->method = read_field(fp, rec->hdr.method_len);
+    rec->payload = rec->method ? read_field(fp, rec->hdr.payload_len) : NULL;
+    rec->reply = rec->payload ? read_field(fp, rec->hdr.reply_len) : NULL;
+    if (!rec->reply) {
+        log_error("capture: truncated record body");
+        capture_record_free(rec);
+        return -1;
+    }
+
+    return 1;
+}
+
+void capture_record_free(struct capture_record *rec)
+{
+    free(rec->method);
+    free(rec->payload);
+    free(rec->reply);
+    rec->method = rec->payload = rec->reply = NULL;
+}
@@ -1,40 +1,38 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <libubus.h>
 #include <libubox/blobmsg_json.h>
 #include <libubox/uloop.h>
 #include "log.h"
+#include "rpc_schema_blob.h"
 
-static struct ubus_context *context;
+// GREET_REPLY_PARTS: reply messages sent per call (default 1). More than one
+// gives the bridge's Direction A streaming a source: a client that sent
+// "stream":true gets each message as a partial frame.
+static unsigned int reply_parts = 1;
 
-enum {
-    WELCOME_NAME,
-    __WELCOME_MAX,
-};
+static struct ubus_context *context;
 
 // Handler declaration
 static int welcome_handler(struct ubus_context *ctx, struct ubus_object *obj,
                           struct ubus_request_data *req, const char *method,
                           struct blob_attr *msg);
 
-static const struct blobmsg_policy welcome_policy[] = {
-    [0] = {.name = "name", .type = BLOBMSG_TYPE_STRING}
-};
-
 // method array definition
 static const struct ubus_method greet_methods[] = {
-    UBUS_METHOD("welcome", welcome_handler, welcome_policy),
+    UBUS_METHOD(GREET_WELCOME_UBUS_METHOD, welcome_handler, greet_welcome_params_policy),
 };
 
 // Add type of greet
 static struct ubus_object_type greet_type = {
-    .name = "greet",
+    .name = GREET_WELCOME_UBUS_OBJECT,
     .methods = greet_methods,
     .n_methods = 1,
 };
 
 // Instance of ubus_object
 static struct ubus_object greet_object = {
-    .name = "greet",
+    .name = GREET_WELCOME_UBUS_OBJECT,
     .type = &greet_type,
     .methods = greet_methods,
     .n_methods = 1,
@@ -47,42 +45,57 @@ static int welcome_handler(struct ubus_context *ctx, struct ubus_object *obj,
     (void)obj;
     (void)method;
     
-    struct blob_attr *tb[__WELCOME_MAX];
+    struct greet_welcome_params params;
 
     // parse binary blobmsg
-    blobmsg_parse(welcome_policy, __WELCOME_MAX, tb, blob_data(msg), blob_len(msg));
-    if (!tb[WELCOME_NAME])
+    if (greet_welcome_params_from_blob(&params, msg) != RPC_JSON_OK)
     {
         log_warn("Missing or invalid 'name' parameter");
         return UBUS_STATUS_INVALID_ARGUMENT;
     }
 
-    // Extract string value
-    char *name = blobmsg_get_string(tb[WELCOME_NAME]);
-    log_debug("Received welcome request for name='%s'", name);
+    log_debug("Received welcome request for name='%s'", params.name);
 
     // Reply
     struct blob_buf b = {};
-    blob_buf_init(&b, 0);
     char msg_buf[256];
 
-    // Build response
-    snprintf(msg_buf, sizeof(msg_buf), "Hello %s, Welcome to XYZ Company", name);
-
-    // Create binary blobmsg reply
-    blobmsg_add_string(&b, "message", msg_buf);
-
-    // Send reply to ubusd
-    ubus_send_reply(ctx, req, b.head);
+    for (unsigned int part = 1; part <= reply_parts; part++)
+    {
+        blob_buf_init(&b, 0);
+
+        // Build response
+        int n = snprintf(msg_buf, sizeof(msg_buf), "Hello %s, Welcome to XYZ Company", params.name);
+        if (reply_parts > 1 && n >= 0 && (size_t)n < sizeof(msg_buf))
+        {
+            snprintf(msg_buf + n, sizeof(msg_buf) - n, " (%u/%u)", part, reply_parts);
+        }
+
+        // Create binary blobmsg reply
+        struct greet_welcome_result result = {
+            .message = msg_buf,
+            .present = GREET_WELCOME_RESULT_HAS_MESSAGE,
+        };
+        greet_welcome_result_to_blob(&b, &result);
+
+        // Send reply to ubusd
+        ubus_send_reply(ctx, req, b.head);
+        log_debug("Sent reply: %s", msg_buf);
+    }
     blob_buf_free(&b);
 
-    log_debug("Sent reply: %s", msg_buf);
     return UBUS_STATUS_OK;
 }
 
 int main(void)
 {
     log_info("Starting greet-ubus-provider...");
+
+    const char *parts = getenv("GREET_REPLY_PARTS");
+    if (parts && strtoul(parts, NULL, 10) > 0)
+    {
+        reply_parts = strtoul(parts, NULL, 10);
+    }
     
     uloop_init();
     log_debug("Event loop initialized");
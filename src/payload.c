@@ -0,0 +1,280 @@
+#define _GNU_SOURCE     // memfd_create(), F_ADD_SEALS, MSG_CMSG_CLOEXEC
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "log.h"
+#include "payload.h"
+
+#define PAYLOAD_ENVELOPE_PREFIX "{\"memfd\":"
+
+// Seals a receiver relies on: the mapping cannot change or shrink under it
+#define PAYLOAD_SEALS_REQUIRED  (F_SEAL_WRITE | F_SEAL_SHRINK)
+#define PAYLOAD_SEALS           (F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+static struct {
+    size_t inline_max;
+    size_t max;
+} cfg = {
+    .inline_max = 64 * 1024,
+    .max = 64 * 1024 * 1024,
+};
+
+static size_t env_size(const char *name, size_t def)
+{
+    const char *val = getenv(name);
+    if (!val || !*val)
+        return def;
+
+    unsigned long long v = strtoull(val, NULL, 10);
+    return v ? (size_t)v : def;
+}
+
+void payload_config_load(void)
+{
+    cfg.inline_max = env_size("RPC_PAYLOAD_INLINE_MAX", cfg.inline_max);
+    cfg.max = env_size("RPC_PAYLOAD_MAX", cfg.max);
+
+    log_debug("payload: inline up to %zu bytes, memfd up to %zu bytes",
+              cfg.inline_max, cfg.max);
+}
+
+size_t payload_inline_max(void)
+{
+    return cfg.inline_max;
+}
+
+int payload_memfd(const void *data, size_t len)
+{
+    int fd = memfd_create("rpc-payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        log_error("payload: memfd_create() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    // One copy into the memfd; everything after this passes the fd around
+    const char *p = data;
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(fd, p + off, len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("payload: memfd write failed: %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        off += n;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, PAYLOAD_SEALS) < 0) {
+        log_error("payload: sealing memfd failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+size_t payload_envelope(char *buf, size_t buflen, size_t size)
+{
+    int n = snprintf(buf, buflen, PAYLOAD_ENVELOPE_PREFIX "%zu}\n", size);
+    return n > 0 && (size_t)n < buflen ? (size_t)n : 0;
+}
+
+bool payload_is_envelope(const char *line, size_t len, size_t *size)
+{
+    size_t plen = sizeof(PAYLOAD_ENVELOPE_PREFIX) - 1;
+    if (len < plen + 2 || memcmp(line, PAYLOAD_ENVELOPE_PREFIX, plen) != 0 || line[len - 1] != '}')
+        return false;
+
+    size_t v = 0;
+    for (size_t i = plen; i < len - 1; i++) {
+        if (line[i] < '0' || line[i] > '9' || i - plen >= 19)
+            return false;
+        v = v * 10 + (line[i] - '0');
+    }
+
+    *size = v;
+    return true;
+}
+
+ssize_t payload_sendmsg_iov(int sock, const struct iovec *iov, int iovcnt, int fd, int flags)
+{
+    struct msghdr msg = {.msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+
+    // The fd rides on the first byte, so it never arrives after its envelope
+    if (fd >= 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, flags | MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+ssize_t payload_sendmsg(int sock, const void *data, size_t len, int fd, int flags)
+{
+    struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+    return payload_sendmsg_iov(sock, &iov, 1, fd, flags);
+}
+
+static int write_all(int sock, const char *data, size_t len, int fd)
+{
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = payload_sendmsg(sock, data + off, len - off, off ? -1 : fd, 0);
+        if (n < 0)
+            return -1;
+        off += n;
+    }
+    return 0;
+}
+
+int payload_write_line(int sock, const char *line, size_t len, bool allow_fd)
+{
+    if (!allow_fd || len <= cfg.inline_max)
+        return write_all(sock, line, len, -1);
+
+    int fd = payload_memfd(line, len);
+    if (fd < 0)
+        return write_all(sock, line, len, -1);
+
+    char env[PAYLOAD_ENVELOPE_MAX];
+    size_t env_len = payload_envelope(env, sizeof(env), len);
+    int ret = write_all(sock, env, env_len, fd);
+    close(fd);      // the receiver holds its own reference now
+
+    log_debug("payload: sent %zu bytes as memfd", len);
+    return ret;
+}
+
+static void fds_push(struct payload_fds *fds, int fd)
+{
+    if (fds->count >= PAYLOAD_MAX_FDS) {
+        log_warn("payload: too many fds pending, dropping one");
+        close(fd);
+        return;
+    }
+    fds->fd[fds->count++] = fd;
+}
+
+ssize_t payload_recv(int sock, void *buf, size_t len, struct payload_fds *fds)
+{
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * PAYLOAD_MAX_FDS)];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = ctl.buf,
+        .msg_controllen = sizeof(ctl.buf),
+    };
+
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0)
+        return n;
+
+    if (msg.msg_flags & MSG_CTRUNC)
+        log_warn("payload: control data truncated, fds lost");
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            fds_push(fds, fd);
+        }
+    }
+
+    return n;
+}
+
+static int fds_pop(struct payload_fds *fds)
+{
+    if (!fds->count)
+        return -1;
+
+    int fd = fds->fd[0];
+    fds->count--;
+    memmove(fds->fd, fds->fd + 1, fds->count * sizeof(int));
+    return fd;
+}
+
+int payload_map_next(struct payload_fds *fds, size_t size, struct payload_map *map)
+{
+    memset(map, 0, sizeof(*map));
+
+    int fd = fds_pop(fds);
+    if (fd < 0) {
+        log_error("payload: envelope without an fd");
+        return -1;
+    }
+
+    // Only a sealed memfd guarantees the bytes cannot change or vanish
+    // (SIGBUS) while they are being parsed
+    int seals = fcntl(fd, F_GET_SEALS);
+    struct stat st = {0};
+    if (seals < 0 || (seals & PAYLOAD_SEALS_REQUIRED) != PAYLOAD_SEALS_REQUIRED) {
+        log_error("payload: fd is not a sealed memfd");
+        close(fd);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != size || !size || size > cfg.max) {
+        log_error("payload: memfd size %lld does not match envelope (%zu, max %zu)",
+                  (long long)st.st_size, size, cfg.max);
+        close(fd);
+        return -1;
+    }
+
+    void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);      // the mapping keeps the memfd alive
+    if (p == MAP_FAILED) {
+        log_error("payload: mmap() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    map->data = p;
+    map->size = size;
+    map->len = size;
+    if (map->data[map->len - 1] == '\n')
+        map->len--;
+    return 0;
+}
+
+void payload_unmap(struct payload_map *map)
+{
+    if (map->data)
+        munmap((void *)map->data, map->size);
+    memset(map, 0, sizeof(*map));
+}
+
+void payload_fds_close(struct payload_fds *fds)
+{
+    while (fds->count)
+        close(fds->fd[--fds->count]);
+}
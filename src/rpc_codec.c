@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libubox/blobmsg_json.h>
+#include "log.h"
+#include "rpc_protocol.h"
+#include "trace.h"
+#include "rpc_schema_blob.h"
+#include "rpc_codec.h"
+
+char *rpc_build_request(const char *method, const struct greet_welcome_params *params, int id,
+                        uint64_t trace_id, size_t *len)
+{
+    struct rpc_jbuf jb;
+    size_t params_len;
+
+    rpc_jbuf_init(&jb, 64);
+    greet_welcome_params_write(&jb, params);
+    char *params_json = rpc_jbuf_finish(&jb, &params_len);
+    if (!params_json)
+        return NULL;
+
+    char trace_str[TRACE_ID_STR_LEN];
+    trace_id_to_str(trace_id, trace_str);
+
+    struct rpc_request req = {
+        .id = id,
+        .method = method,
+        .params = params_json,
+        .params_len = params_len,
+        .trace_id = trace_str,  // Propagate trace id upstream
+        .stream = true,         // Partial frames become separate ubus replies
+        .accept_fd = true,      // Large replies may come as a memfd
+        .present = RPC_REQUEST_HAS_ID | RPC_REQUEST_HAS_METHOD | RPC_REQUEST_HAS_PARAMS |
+                   RPC_REQUEST_HAS_TRACE_ID | RPC_REQUEST_HAS_STREAM | RPC_REQUEST_HAS_ACCEPT_FD,
+    };
+
+    rpc_jbuf_init(&jb, params_len + 128);
+    rpc_request_write(&jb, &req);
+    rpc_jbuf_char(&jb, '\n');   // Line terminator as in rpc_server
+    free(params_json);
+
+    char *line = rpc_jbuf_finish(&jb, len);
+    if (line) {
+        log_debug("Built RPC request: %.*s", (int)(*len - 1), line);
+    }
+    return line;
+}
+
+int rpc_read_request(const char *buf, size_t len, struct rpc_request *req,
+                     struct greet_welcome_params *params)
+{
+    memset(params, 0, sizeof(*params));
+    if (rpc_request_read(req, buf, len) == RPC_JSON_INVALID)
+        return RPC_JSON_INVALID;
+    if (!(req->present & RPC_REQUEST_HAS_PARAMS))
+        return RPC_JSON_MISSING;
+
+    // params that are not an object have no name either
+    return greet_welcome_params_read(params, req->params, req->params_len) == RPC_JSON_OK ?
+           RPC_JSON_OK : RPC_JSON_MISSING;
+}
+
+int rpc_read_reply(const char *buf, size_t len, struct rpc_reply *reply,
+                   struct greet_welcome_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    if (rpc_reply_read(reply, buf, len) == RPC_JSON_INVALID)
+        return RPC_JSON_INVALID;
+    if (!(reply->present & RPC_REPLY_HAS_RESULT))
+        return RPC_JSON_MISSING;
+
+    return greet_welcome_result_read(result, reply->result, reply->result_len) == RPC_JSON_OK ?
+           RPC_JSON_OK : RPC_JSON_MISSING;
+}
+
+char *rpc_result_json(struct blob_attr *msg)
+{
+    struct greet_welcome_result result;
+    struct blob_attr *pos;
+    size_t rem;
+    int members = 0;
+
+    blob_for_each_attr(pos, msg, rem) {
+        members++;
+    }
+    if (greet_welcome_result_from_blob(&result, msg) != RPC_JSON_OK ||
+        members != __builtin_popcount(result.present)) {
+        return blobmsg_format_json(msg, true);
+    }
+
+    struct rpc_jbuf jb;
+    rpc_jbuf_init(&jb, strlen(result.message) + 16);
+    greet_welcome_result_write(&jb, &result);
+    return rpc_jbuf_finish(&jb, NULL);
+}
+
+// One newline-terminated reply line from the generated writer (malloc'd)
+static char *format_reply(const struct rpc_reply *reply, size_t hint, size_t *len)
+{
+    struct rpc_jbuf jb;
+
+    rpc_jbuf_init(&jb, hint + 64);
+    rpc_reply_write(&jb, reply);
+    rpc_jbuf_char(&jb, '\n');
+    return rpc_jbuf_finish(&jb, len);
+}
+
+char *rpc_format_result(int id, const char *result_json)
+{
+    size_t result_len = strlen(result_json);
+    struct rpc_reply reply = {
+        .id = id,
+        .result = result_json,
+        .result_len = result_len,
+        .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_RESULT | RPC_REPLY_HAS_ERROR,
+    };
+
+    return format_reply(&reply, result_len, NULL);
+}
+
+char *rpc_format_partial(int id, const char *partial_json, size_t *len)
+{
+    size_t partial_len = strlen(partial_json);
+    struct rpc_reply reply = {
+        .id = id,
+        .partial = partial_json,
+        .partial_len = partial_len,
+        .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_PARTIAL,
+    };
+
+    return format_reply(&reply, partial_len, len);
+}
+
+char *rpc_format_error(int id, int code, const char *message)
+{
+    struct rpc_error error = {
+        .code = code,
+        .message = message,
+        .present = RPC_ERROR_HAS_CODE | RPC_ERROR_HAS_MESSAGE,
+    };
+    struct rpc_jbuf jb;
+    size_t error_len;
+
+    rpc_jbuf_init(&jb, strlen(message) + 32);
+    rpc_error_write(&jb, &error);
+    char *error_json = rpc_jbuf_finish(&jb, &error_len);
+    if (!error_json)
+        return NULL;
+
+    // "result":null, as for every error reply
+    struct rpc_reply reply = {
+        .id = id,
+        .error = error_json,
+        .error_len = error_len,
+        .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_RESULT | RPC_REPLY_HAS_ERROR,
+    };
+    char *line = format_reply(&reply, error_len, NULL);
+    free(error_json);
+    return line;
+}
+
+json_object *rpc_parse(const char *buf, size_t len)
+{
+    json_tokener *tok = json_tokener_new();
+    if (!tok)
+        return NULL;
+
+    json_object *obj = json_tokener_parse_ex(tok, buf, (int)len);
+    json_tokener_free(tok);
+    return obj;
+}
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "rpc_json.h"
+
+#define RPC_JSON_MAX_DEPTH  64      // nesting skipped over inside one value
+
+// ============== READER ==============
+static void skip_ws(struct rpc_jscan *s)
+{
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
+        s->p++;
+}
+
+int rpc_jscan_begin(struct rpc_jscan *s, const char *json, size_t len, char **arena)
+{
+    s->p = json;
+    s->end = json + len;
+    s->first = true;
+    s->arena = arena;
+    s->arena_pos = NULL;
+    s->arena_size = len + 1;    // decoded strings plus NULs never outgrow the input
+
+    skip_ws(s);
+    if (s->p == s->end || *s->p != '{')
+        return -1;
+    s->p++;
+    return 0;
+}
+
+// Past the closing quote of the string starting at s->p ('"'); -1 if unterminated
+static int skip_string(struct rpc_jscan *s)
+{
+    const char *p = s->p + 1;
+
+    while (p < s->end) {
+        if (*p == '"') {
+            s->p = p + 1;
+            return 0;
+        }
+        if (*p == '\\')
+            p++;
+        else if ((unsigned char)*p < 0x20)
+            return -1;
+        p++;
+    }
+    return -1;
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Past the number at s->p: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static int skip_number(struct rpc_jscan *s)
+{
+    const char *p = s->p;
+
+    if (p < s->end && *p == '-')
+        p++;
+    if (p == s->end || !is_digit(*p))
+        return -1;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < s->end && is_digit(*p))
+            p++;
+    }
+
+    if (p < s->end && *p == '.') {
+        if (++p == s->end || !is_digit(*p))
+            return -1;
+        while (p < s->end && is_digit(*p))
+            p++;
+    }
+
+    if (p < s->end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < s->end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == s->end || !is_digit(*p))
+            return -1;
+        while (p < s->end && is_digit(*p))
+            p++;
+    }
+
+    s->p = p;
+    return 0;
+}
+
+// Past the null/true/false at s->p
+static int skip_literal(struct rpc_jscan *s)
+{
+    static const char *const literals[] = {"null", "true", "false"};
+    size_t left = s->end - s->p;
+
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        size_t n = strlen(literals[i]);
+        if (left >= n && !memcmp(s->p, literals[i], n)) {
+            s->p += n;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// What may come next inside the value being skipped
+enum skip_state {
+    SKIP_VALUE,             // top level, after ':', after ',' in an array
+    SKIP_VALUE_OR_END,      // after '['
+    SKIP_KEY,               // after ',' in an object
+    SKIP_KEY_OR_END,        // after '{'
+    SKIP_COLON,             // after a key
+    SKIP_NEXT,              // after a member or element: ',' or the closing bracket
+};
+
+int rpc_jscan_skip(struct rpc_jscan *s)
+{
+    uint64_t stack = 0;     // one bit per level: 1 = object, 0 = array
+    int depth = 0;
+    enum skip_state state = SKIP_VALUE;
+
+    skip_ws(s);
+    do {
+        if (s->p == s->end)
+            return -1;
+
+        char c = *s->p;
+        bool in_object = stack & 1;
+
+        if ((state == SKIP_KEY_OR_END && c == '}') || (state == SKIP_VALUE_OR_END && c == ']') ||
+            (state == SKIP_NEXT && (c == '}' || c == ']'))) {
+            if ((c == '}') != in_object)
+                return -1;
+            stack >>= 1;
+            depth--;
+            s->p++;
+            state = SKIP_NEXT;
+        } else if (state == SKIP_NEXT) {
+            if (c != ',')
+                return -1;
+            s->p++;
+            state = in_object ? SKIP_KEY : SKIP_VALUE;
+        } else if (state == SKIP_KEY || state == SKIP_KEY_OR_END) {
+            if (c != '"' || skip_string(s) < 0)
+                return -1;
+            state = SKIP_COLON;
+        } else if (state == SKIP_COLON) {
+            if (c != ':')
+                return -1;
+            s->p++;
+            state = SKIP_VALUE;
+        } else if (c == '{' || c == '[') {
+            if (depth == RPC_JSON_MAX_DEPTH)
+                return -1;
+            stack = (stack << 1) | (c == '{');
+            depth++;
+            s->p++;
+            state = c == '{' ? SKIP_KEY_OR_END : SKIP_VALUE_OR_END;
+        } else {
+            int ret;
+            if (c == '"')
+                ret = skip_string(s);
+            else if (c == '-' || is_digit(c))
+                ret = skip_number(s);
+            else
+                ret = skip_literal(s);
+            if (ret < 0)
+                return -1;
+            state = SKIP_NEXT;
+        }
+        skip_ws(s);
+    } while (depth);
+
+    return 0;
+}
+
+int rpc_jscan_key(struct rpc_jscan *s, const char **key, size_t *klen)
+{
+    skip_ws(s);
+    if (s->p == s->end)
+        return -1;
+
+    if (*s->p == '}') {
+        s->p++;
+        skip_ws(s);
+        return s->p == s->end ? 0 : -1;
+    }
+
+    if (!s->first) {
+        if (*s->p != ',')
+            return -1;
+        s->p++;
+        skip_ws(s);
+        if (s->p == s->end)
+            return -1;
+    }
+    s->first = false;
+
+    if (*s->p != '"')
+        return -1;
+    const char *start = s->p + 1;
+    if (skip_string(s) < 0)
+        return -1;
+    *key = start;
+    *klen = s->p - 1 - start;
+
+    skip_ws(s);
+    if (s->p == s->end || *s->p != ':')
+        return -1;
+    s->p++;
+    skip_ws(s);
+    return 1;
+}
+
+// Skip a value of another type (or null); 0 if it was well-formed
+static int skip_other(struct rpc_jscan *s)
+{
+    return rpc_jscan_skip(s) < 0 ? -1 : 0;
+}
+
+static int hex4(const char *p, unsigned int *out)
+{
+    unsigned int v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9')
+            v |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            v |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static char *put_utf8(char *o, unsigned int cp)
+{
+    if (cp < 0x80) {
+        *o++ = (char)cp;
+    } else if (cp < 0x800) {
+        *o++ = (char)(0xc0 | (cp >> 6));
+        *o++ = (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        *o++ = (char)(0xe0 | (cp >> 12));
+        *o++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *o++ = (char)(0x80 | (cp & 0x3f));
+    } else {
+        *o++ = (char)(0xf0 | (cp >> 18));
+        *o++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+        *o++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *o++ = (char)(0x80 | (cp & 0x3f));
+    }
+    return o;
+}
+
+int rpc_jscan_string(struct rpc_jscan *s, const char **out)
+{
+    if (s->p == s->end)
+        return -1;
+    if (*s->p != '"')
+        return skip_other(s);
+
+    if (!s->arena_pos) {
+        *s->arena = malloc(s->arena_size);
+        if (!*s->arena)
+            return -1;
+        s->arena_pos = *s->arena;
+    }
+
+    const char *p = s->p + 1;
+    char *o = s->arena_pos;
+
+    while (p < s->end && *p != '"') {
+        char c = *p++;
+        if ((unsigned char)c < 0x20)
+            return -1;
+        if (c != '\\') {
+            *o++ = c;
+            continue;
+        }
+        if (p == s->end)
+            return -1;
+
+        switch (c = *p++) {
+        case '"': case '\\': case '/':
+            *o++ = c;
+            break;
+        case 'b': *o++ = '\b'; break;
+        case 'f': *o++ = '\f'; break;
+        case 'n': *o++ = '\n'; break;
+        case 'r': *o++ = '\r'; break;
+        case 't': *o++ = '\t'; break;
+        case 'u': {
+            unsigned int cp, lo;
+            if (s->end - p < 4 || hex4(p, &cp) < 0)
+                return -1;
+            p += 4;
+            if (cp >= 0xd800 && cp < 0xdc00) {
+                // UTF-16 surrogate pair, e.g. \ud83d\ude00; a lone half is not UTF-8
+                if (s->end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                    hex4(p + 2, &lo) < 0 || lo < 0xdc00 || lo >= 0xe000)
+                    return -1;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                p += 6;
+            } else if ((cp >= 0xdc00 && cp < 0xe000) || cp == 0) {
+                return -1;      // lone low surrogate, or a NUL that would cut the string short
+            }
+            o = put_utf8(o, cp);
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    if (p == s->end)
+        return -1;
+
+    *o++ = '\0';
+    *out = s->arena_pos;
+    s->arena_pos = o;
+    s->p = p + 1;
+    return 1;
+}
+
+int rpc_jscan_int(struct rpc_jscan *s, int *out)
+{
+    const char *p = s->p;
+    bool neg = false;
+    long long v = 0;
+
+    if (p < s->end && *p == '-') {
+        neg = true;
+        p++;
+    }
+    // Not a digit, or a leading zero: let the number grammar decide
+    if (p == s->end || !is_digit(*p) || (*p == '0' && p + 1 < s->end && is_digit(p[1])))
+        return skip_other(s);
+
+    while (p < s->end && is_digit(*p)) {
+        v = v * 10 + (*p++ - '0');
+        if (v > (long long)INT_MAX + 1)
+            return skip_other(s);
+    }
+    // Fractions and exponents are not ints
+    if (p < s->end && (*p == '.' || *p == 'e' || *p == 'E'))
+        return skip_other(s);
+    if (neg)
+        v = -v;
+    if (v > INT_MAX)
+        return skip_other(s);
+
+    *out = (int)v;
+    s->p = p;
+    return 1;
+}
+
+int rpc_jscan_bool(struct rpc_jscan *s, bool *out)
+{
+    size_t left = s->end - s->p;
+
+    if (left >= 4 && !memcmp(s->p, "true", 4)) {
+        *out = true;
+        s->p += 4;
+        return 1;
+    }
+    if (left >= 5 && !memcmp(s->p, "false", 5)) {
+        *out = false;
+        s->p += 5;
+        return 1;
+    }
+    return skip_other(s);
+}
+
+int rpc_jscan_raw(struct rpc_jscan *s, const char **out, size_t *len)
+{
+    const char *start = s->p;
+
+    if (rpc_jscan_skip(s) < 0)
+        return -1;
+    if (s->p - start >= 4 && !memcmp(start, "null", 4))
+        return 0;
+
+    // The skip also consumed trailing whitespace
+    const char *end = s->p;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+        end--;
+    *out = start;
+    *len = end - start;
+    return 1;
+}
+
+// ============== WRITER ==============
+static bool jbuf_reserve(struct rpc_jbuf *jb, size_t n)
+{
+    if (jb->failed)
+        return false;
+    if (jb->cap - jb->len > n)
+        return true;
+
+    size_t cap = jb->cap ? jb->cap : 256;
+    while (cap - jb->len <= n)
+        cap *= 2;
+
+    char *grown = realloc(jb->data, cap);
+    if (!grown) {
+        jb->failed = true;
+        return false;
+    }
+    jb->data = grown;
+    jb->cap = cap;
+    return true;
+}
+
+void rpc_jbuf_init(struct rpc_jbuf *jb, size_t hint)
+{
+    memset(jb, 0, sizeof(*jb));
+    if (hint)
+        jbuf_reserve(jb, hint);
+}
+
+void rpc_jbuf_raw(struct rpc_jbuf *jb, const char *data, size_t len)
+{
+    if (!jbuf_reserve(jb, len))
+        return;
+    memcpy(jb->data + jb->len, data, len);
+    jb->len += len;
+}
+
+void rpc_jbuf_char(struct rpc_jbuf *jb, char c)
+{
+    if (!jbuf_reserve(jb, 1))
+        return;
+    jb->data[jb->len++] = c;
+}
+
+void rpc_jbuf_str(struct rpc_jbuf *jb, const char *str)
+{
+    size_t n = strlen(str);
+
+    // Worst case every byte becomes \u00XX
+    if (!jbuf_reserve(jb, n * 6 + 2))
+        return;
+
+    char *o = jb->data + jb->len;
+    *o++ = '"';
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        switch (*p) {
+        case '"':  *o++ = '\\'; *o++ = '"'; break;
+        case '\\': *o++ = '\\'; *o++ = '\\'; break;
+        case '\n': *o++ = '\\'; *o++ = 'n'; break;
+        case '\r': *o++ = '\\'; *o++ = 'r'; break;
+        case '\t': *o++ = '\\'; *o++ = 't'; break;
+        default:
+            if (*p < 0x20) {
+                o += sprintf(o, "\\u%04x", *p);
+            } else {
+                *o++ = (char)*p;
+            }
+        }
+    }
+    *o++ = '"';
+    jb->len = o - jb->data;
+}
+
+void rpc_jbuf_int(struct rpc_jbuf *jb, int v)
+{
+    if (!jbuf_reserve(jb, 12))
+        return;
+    jb->len += sprintf(jb->data + jb->len, "%d", v);
+}
+
+void rpc_jbuf_bool(struct rpc_jbuf *jb, bool v)
+{
+    if (v)
+        rpc_jbuf_raw(jb, "true", 4);
+    else
+        rpc_jbuf_raw(jb, "false", 5);
+}
+
+char *rpc_jbuf_finish(struct rpc_jbuf *jb, size_t *len)
+{
+    if (!jbuf_reserve(jb, 1)) {
+        rpc_jbuf_free(jb);
+        return NULL;
+    }
+
+    char *data = jb->data;
+    data[jb->len] = '\0';
+    if (len)
+        *len = jb->len;
+
+    memset(jb, 0, sizeof(*jb));
+    return data;
+}
+
+void rpc_jbuf_free(struct rpc_jbuf *jb)
+{
+    free(jb->data);
+    memset(jb, 0, sizeof(*jb));
+}
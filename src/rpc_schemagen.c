@@ -0,0 +1,662 @@
+/*
+ * Generates specialized parse/serialize code from the bridge's message schema.
+ *
+ *   rpc_schemagen schema/rpc.schema outdir
+ *
+ * Writes outdir/rpc_schema.{h,c} and outdir/rpc_schema_blob.{h,c}. Every
+ * struct in the schema gets a fixed-layout C struct, a JSON reader that maps
+ * member names to fields through a perfect hash found here at build time, a
+ * JSON writer that emits the members directly, and a free function. Structs
+ * used as a method's params or result also get a blobmsg policy and
+ * blob <-> struct converters. The generated code needs only rpc_json.c (and
+ * libubox for the blob part). Runs on the build host; uses no libraries.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#define GEN_MAX_NAME        48
+#define GEN_MAX_FIELDS      32      // one presence bit each
+#define GEN_MAX_STRUCTS     64
+#define GEN_MAX_METHODS     64
+#define GEN_HASH_SEEDS      100000
+
+enum field_type {
+    TYPE_STRING,
+    TYPE_INT,
+    TYPE_BOOL,
+    TYPE_RAW,
+};
+
+static const char *const type_names[] = {"string", "int", "bool", "raw"};
+
+struct field {
+    char name[GEN_MAX_NAME];
+    enum field_type type;
+    bool required;
+};
+
+struct schema_struct {
+    char name[GEN_MAX_NAME];
+    struct field fields[GEN_MAX_FIELDS];
+    unsigned int n;
+    int line;
+    bool blob;                  // params/result of a method
+
+    // Perfect hash: FNV-1a of the key starting from 'seed', modulo 'slots'
+    uint32_t seed;
+    unsigned int slots;
+    int slot_field[GEN_MAX_FIELDS * 4];
+};
+
+struct schema_method {
+    char rpc[GEN_MAX_NAME];
+    char object[GEN_MAX_NAME];
+    char method[GEN_MAX_NAME];
+    char params[GEN_MAX_NAME];
+    char result[GEN_MAX_NAME];
+    int line;
+};
+
+static struct schema_struct structs[GEN_MAX_STRUCTS];
+static unsigned int n_structs;
+static struct schema_method methods[GEN_MAX_METHODS];
+static unsigned int n_methods;
+
+static const char *schema_path;
+
+static void die(int line, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (line)
+        fprintf(stderr, "%s:%d: ", schema_path, line);
+    else
+        fprintf(stderr, "rpc_schemagen: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+// ============== PARSER ==============
+static bool is_ident(const char *s)
+{
+    if (!*s || !(islower((unsigned char)*s) || *s == '_'))
+        return false;
+    for (; *s; s++) {
+        if (!(islower((unsigned char)*s) || isdigit((unsigned char)*s) || *s == '_'))
+            return false;
+    }
+    return true;
+}
+
+static void copy_name(char *dst, const char *src, int line)
+{
+    if (strlen(src) >= GEN_MAX_NAME)
+        die(line, "name too long: %s", src);
+    strcpy(dst, src);
+}
+
+static struct schema_struct *find_struct(const char *name)
+{
+    for (unsigned int i = 0; i < n_structs; i++) {
+        if (!strcmp(structs[i].name, name))
+            return &structs[i];
+    }
+    return NULL;
+}
+
+static void parse_schema(FILE *f)
+{
+    char buf[512];
+    int line = 0;
+    struct schema_struct *cur_struct = NULL;
+    struct schema_method *cur_method = NULL;
+
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+
+        char *hash = strchr(buf, '#');
+        if (hash)
+            *hash = '\0';
+
+        // Declarations start in column 0, their members are indented
+        bool member = buf[0] == ' ' || buf[0] == '\t';
+
+        char *tok[5];
+        int n = 0;
+        for (char *t = strtok(buf, " \t\r\n"); t; t = strtok(NULL, " \t\r\n")) {
+            if (n == 5)
+                die(line, "too many words");
+            tok[n++] = t;
+        }
+        if (!n)
+            continue;
+
+        if (member && !cur_struct && !cur_method) {
+            die(line, "indented line outside a struct or method");
+        } else if (!member && !strcmp(tok[0], "struct")) {
+            if (n != 2 || !is_ident(tok[1]))
+                die(line, "expected: struct <name>");
+            if (find_struct(tok[1]))
+                die(line, "struct %s defined twice", tok[1]);
+            if (n_structs == GEN_MAX_STRUCTS)
+                die(line, "too many structs");
+            cur_struct = &structs[n_structs++];
+            cur_method = NULL;
+            copy_name(cur_struct->name, tok[1], line);
+            cur_struct->line = line;
+        } else if (!member && !strcmp(tok[0], "method")) {
+            if (n != 4)
+                die(line, "expected: method <json-rpc method> <ubus object> <ubus method>");
+            if (n_methods == GEN_MAX_METHODS)
+                die(line, "too many methods");
+            cur_method = &methods[n_methods++];
+            cur_struct = NULL;
+            copy_name(cur_method->rpc, tok[1], line);
+            copy_name(cur_method->object, tok[2], line);
+            copy_name(cur_method->method, tok[3], line);
+            cur_method->line = line;
+        } else if (!member) {
+            die(line, "expected struct or method");
+        } else if (cur_method) {
+            if (n != 2 || (strcmp(tok[0], "params") && strcmp(tok[0], "result")))
+                die(line, "expected: params <struct> or result <struct>");
+            copy_name(!strcmp(tok[0], "params") ? cur_method->params : cur_method->result,
+                      tok[1], line);
+        } else if (cur_struct) {
+            if (n < 2 || n > 3 || (n == 3 && strcmp(tok[2], "required")))
+                die(line, "expected: <field> <type> [required]");
+            if (!is_ident(tok[0]))
+                die(line, "bad field name: %s", tok[0]);
+            if (cur_struct->n == GEN_MAX_FIELDS)
+                die(line, "more than %d fields in %s", GEN_MAX_FIELDS, cur_struct->name);
+
+            struct field *fl = &cur_struct->fields[cur_struct->n];
+            for (unsigned int i = 0; i < cur_struct->n; i++) {
+                if (!strcmp(cur_struct->fields[i].name, tok[0]))
+                    die(line, "field %s defined twice", tok[0]);
+            }
+            copy_name(fl->name, tok[0], line);
+
+            unsigned int t;
+            for (t = 0; t < sizeof(type_names) / sizeof(type_names[0]); t++) {
+                if (!strcmp(tok[1], type_names[t]))
+                    break;
+            }
+            if (t == sizeof(type_names) / sizeof(type_names[0]))
+                die(line, "unknown type: %s", tok[1]);
+            fl->type = (enum field_type)t;
+            fl->required = n == 3;
+            cur_struct->n++;
+        }
+    }
+}
+
+static void mark_blob(const char *name, int line)
+{
+    struct schema_struct *st = find_struct(name);
+
+    if (!st)
+        die(line, "unknown struct: %s", name);
+    for (unsigned int i = 0; i < st->n; i++) {
+        if (st->fields[i].type == TYPE_RAW)
+            die(line, "%s.%s: raw fields have no blobmsg form", st->name, st->fields[i].name);
+    }
+    st->blob = true;
+}
+
+static void check_schema(void)
+{
+    for (unsigned int i = 0; i < n_structs; i++) {
+        if (!structs[i].n)
+            die(structs[i].line, "struct %s has no fields", structs[i].name);
+    }
+    for (unsigned int i = 0; i < n_methods; i++) {
+        if (!methods[i].params[0] || !methods[i].result[0])
+            die(methods[i].line, "method %s needs params and result", methods[i].rpc);
+        mark_blob(methods[i].params, methods[i].line);
+        mark_blob(methods[i].result, methods[i].line);
+    }
+}
+
+// ============== PERFECT HASH ==============
+static uint32_t key_hash(uint32_t seed, const char *key)
+{
+    uint32_t h = seed;
+    for (; *key; key++)
+        h = (h ^ (uint8_t)*key) * 16777619u;
+    return h;
+}
+
+// Smallest table (then first seed) where every field gets its own slot
+static void find_hash(struct schema_struct *st)
+{
+    for (unsigned int slots = st->n; slots <= st->n * 4; slots++) {
+        for (uint32_t i = 0; i < GEN_HASH_SEEDS; i++) {
+            uint32_t seed = 2166136261u + i;
+            bool ok = true;
+
+            for (unsigned int s = 0; s < slots; s++)
+                st->slot_field[s] = -1;
+            for (unsigned int f = 0; f < st->n && ok; f++) {
+                unsigned int s = key_hash(seed, st->fields[f].name) % slots;
+                if (st->slot_field[s] >= 0)
+                    ok = false;
+                else
+                    st->slot_field[s] = (int)f;
+            }
+
+            if (ok) {
+                st->seed = seed;
+                st->slots = slots;
+                return;
+            }
+        }
+    }
+    die(st->line, "no perfect hash found for %s", st->name);
+}
+
+// ============== OUTPUT ==============
+static FILE *out;
+
+static void emit(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(out, fmt, ap);
+    va_end(ap);
+}
+
+static void upper(char *dst, const char *src)
+{
+    for (; *src; src++)
+        *dst++ = (*src == '.') ? '_' : (char)toupper((unsigned char)*src);
+    *dst = '\0';
+}
+
+static void open_out(const char *dir, const char *name, char *tmp, char *final)
+{
+    snprintf(final, 512, "%s/%s", dir, name);
+    snprintf(tmp, 512, "%s.tmp", final);
+    out = fopen(tmp, "w");
+    if (!out)
+        die(0, "cannot write %s", tmp);
+    emit("// Generated by rpc_schemagen from %s. Do not edit.\n", schema_path);
+}
+
+static void close_out(const char *tmp, const char *final)
+{
+    if (fclose(out) != 0 || rename(tmp, final) != 0)
+        die(0, "cannot write %s", final);
+}
+
+static uint32_t required_mask(const struct schema_struct *st)
+{
+    uint32_t mask = 0;
+    for (unsigned int i = 0; i < st->n; i++) {
+        if (st->fields[i].required)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+static void emit_header(void)
+{
+    emit("#ifndef RPC_SCHEMA_H\n"
+         "#define RPC_SCHEMA_H\n\n"
+         "#include <stdint.h>\n"
+         "#include <stddef.h>\n"
+         "#include <stdbool.h>\n"
+         "#include \"rpc_json.h\"\n");
+
+    if (n_methods)
+        emit("\n// ============== METHODS ==============\n");
+    for (unsigned int i = 0; i < n_methods; i++) {
+        char up[GEN_MAX_NAME];
+        upper(up, methods[i].rpc);
+        emit("#define %s_RPC \"%s\"\n", up, methods[i].rpc);
+        emit("#define %s_UBUS_OBJECT \"%s\"\n", up, methods[i].object);
+        emit("#define %s_UBUS_METHOD \"%s\"\n", up, methods[i].method);
+    }
+
+    for (unsigned int i = 0; i < n_structs; i++) {
+        const struct schema_struct *st = &structs[i];
+        char up[GEN_MAX_NAME], fup[GEN_MAX_NAME];
+
+        upper(up, st->name);
+        emit("\n// ============== %s ==============\n", st->name);
+        for (unsigned int f = 0; f < st->n; f++) {
+            upper(fup, st->fields[f].name);
+            emit("#define %s_HAS_%s (1u << %u)\n", up, fup, f);
+        }
+        emit("#define %s_REQUIRED 0x%xu\n\n", up, required_mask(st));
+
+        emit("struct %s {\n", st->name);
+        for (unsigned int f = 0; f < st->n; f++) {
+            const struct field *fl = &st->fields[f];
+            switch (fl->type) {
+            case TYPE_STRING:
+                emit("    const char *%s;\n", fl->name);
+                break;
+            case TYPE_INT:
+                emit("    int %s;\n", fl->name);
+                break;
+            case TYPE_BOOL:
+                emit("    bool %s;\n", fl->name);
+                break;
+            case TYPE_RAW:
+                emit("    const char *%s;      // JSON text, not NUL-terminated\n", fl->name);
+                emit("    size_t %s_len;\n", fl->name);
+                break;
+            }
+        }
+        emit("    uint32_t present;       // %s_HAS_* of the fields set\n", up);
+        emit("    char *arena;            // strings decoded by %s_read()\n", st->name);
+        emit("};\n\n");
+
+        emit("// RPC_JSON_OK, RPC_JSON_INVALID or RPC_JSON_MISSING; call %s_free() in any case\n",
+             st->name);
+        emit("int %s_read(struct %s *s, const char *json, size_t len);\n", st->name, st->name);
+        emit("void %s_write(struct rpc_jbuf *jb, const struct %s *s);\n", st->name, st->name);
+        emit("void %s_free(struct %s *s);\n", st->name, st->name);
+    }
+
+    emit("\n#endif\n");
+}
+
+static void emit_source(void)
+{
+    emit("#include <string.h>\n"
+         "#include <stdlib.h>\n"
+         "#include \"rpc_schema.h\"\n");
+
+    for (unsigned int i = 0; i < n_structs; i++) {
+        const struct schema_struct *st = &structs[i];
+        const char *n = st->name;
+        char up[GEN_MAX_NAME], fup[GEN_MAX_NAME];
+
+        upper(up, n);
+        emit("\n// ============== %s ==============\n", n);
+
+        // Key table indexed by the perfect hash
+        emit("static const struct {\n"
+             "    const char *key;\n"
+             "    uint8_t len;\n"
+             "    int8_t field;\n"
+             "} %s_keys[%u] = {\n", n, st->slots);
+        for (unsigned int s = 0; s < st->slots; s++) {
+            int f = st->slot_field[s];
+            if (f < 0)
+                emit("    {\"\", 0, -1},\n");
+            else
+                emit("    {\"%s\", %zu, %d},\n", st->fields[f].name, strlen(st->fields[f].name), f);
+        }
+        emit("};\n\n");
+
+        emit("static int %s_field(const char *key, size_t len)\n"
+             "{\n"
+             "    uint32_t h = 0x%08xu;\n\n"
+             "    for (size_t i = 0; i < len; i++)\n"
+             "        h = (h ^ (uint8_t)key[i]) * 16777619u;\n\n"
+             "    unsigned int slot = h %% %uu;\n"
+             "    if (%s_keys[slot].len != len || memcmp(%s_keys[slot].key, key, len))\n"
+             "        return -1;\n"
+             "    return %s_keys[slot].field;\n"
+             "}\n\n", n, st->seed, st->slots, n, n, n);
+
+        // Reader
+        emit("int %s_read(struct %s *s, const char *json, size_t len)\n"
+             "{\n"
+             "    struct rpc_jscan sc;\n"
+             "    const char *key;\n"
+             "    size_t klen;\n"
+             "    int ret;\n\n"
+             "    memset(s, 0, sizeof(*s));\n"
+             "    if (rpc_jscan_begin(&sc, json, len, &s->arena) < 0)\n"
+             "        return RPC_JSON_INVALID;\n\n"
+             "    while ((ret = rpc_jscan_key(&sc, &key, &klen)) > 0) {\n"
+             "        switch (%s_field(key, klen)) {\n", n, n, n);
+        for (unsigned int f = 0; f < st->n; f++) {
+            const struct field *fl = &st->fields[f];
+            upper(fup, fl->name);
+            emit("        case %u:\n", f);
+            switch (fl->type) {
+            case TYPE_STRING:
+                emit("            ret = rpc_jscan_string(&sc, &s->%s);\n", fl->name);
+                break;
+            case TYPE_INT:
+                emit("            ret = rpc_jscan_int(&sc, &s->%s);\n", fl->name);
+                break;
+            case TYPE_BOOL:
+                emit("            ret = rpc_jscan_bool(&sc, &s->%s);\n", fl->name);
+                break;
+            case TYPE_RAW:
+                emit("            ret = rpc_jscan_raw(&sc, &s->%s, &s->%s_len);\n", fl->name, fl->name);
+                break;
+            }
+            emit("            if (ret > 0)\n"
+                 "                s->present |= %s_HAS_%s;\n"
+                 "            break;\n", up, fup);
+        }
+        emit("        default:\n"
+             "            ret = rpc_jscan_skip(&sc);\n"
+             "            break;\n"
+             "        }\n"
+             "        if (ret < 0)\n"
+             "            return RPC_JSON_INVALID;\n"
+             "    }\n"
+             "    if (ret < 0)\n"
+             "        return RPC_JSON_INVALID;\n\n"
+             "    return (s->present & %s_REQUIRED) == %s_REQUIRED ? RPC_JSON_OK : RPC_JSON_MISSING;\n"
+             "}\n\n", up, up);
+
+        // Writer
+        emit("void %s_write(struct rpc_jbuf *jb, const struct %s *s)\n"
+             "{\n"
+             "    char sep = '{';\n\n", n, n);
+        for (unsigned int f = 0; f < st->n; f++) {
+            const struct field *fl = &st->fields[f];
+            upper(fup, fl->name);
+            emit("    if (s->present & %s_HAS_%s) {\n"
+                 "        rpc_jbuf_char(jb, sep);\n"
+                 "        rpc_jbuf_raw(jb, \"\\\"%s\\\":\", %zu);\n", up, fup, fl->name, strlen(fl->name) + 3);
+            switch (fl->type) {
+            case TYPE_STRING:
+                emit("        if (s->%s)\n"
+                     "            rpc_jbuf_str(jb, s->%s);\n"
+                     "        else\n"
+                     "            rpc_jbuf_raw(jb, \"null\", 4);\n", fl->name, fl->name);
+                break;
+            case TYPE_INT:
+                emit("        rpc_jbuf_int(jb, s->%s);\n", fl->name);
+                break;
+            case TYPE_BOOL:
+                emit("        rpc_jbuf_bool(jb, s->%s);\n", fl->name);
+                break;
+            case TYPE_RAW:
+                emit("        if (s->%s)\n"
+                     "            rpc_jbuf_raw(jb, s->%s, s->%s_len);\n"
+                     "        else\n"
+                     "            rpc_jbuf_raw(jb, \"null\", 4);\n", fl->name, fl->name, fl->name);
+                break;
+            }
+            emit("        sep = ',';\n"
+                 "    }\n");
+        }
+        emit("    if (sep == '{')\n"
+             "        rpc_jbuf_char(jb, '{');\n"
+             "    rpc_jbuf_char(jb, '}');\n"
+             "}\n\n");
+
+        emit("void %s_free(struct %s *s)\n"
+             "{\n"
+             "    free(s->arena);\n"
+             "    s->arena = NULL;\n"
+             "}\n", n, n);
+    }
+}
+
+static const char *const blob_types[] = {
+    [TYPE_STRING] = "BLOBMSG_TYPE_STRING",
+    [TYPE_INT] = "BLOBMSG_TYPE_INT32",
+    [TYPE_BOOL] = "BLOBMSG_TYPE_BOOL",
+};
+
+static void emit_blob_header(void)
+{
+    emit("#ifndef RPC_SCHEMA_BLOB_H\n"
+         "#define RPC_SCHEMA_BLOB_H\n\n"
+         "#include <libubox/blobmsg.h>\n"
+         "#include \"rpc_schema.h\"\n");
+
+    for (unsigned int i = 0; i < n_structs; i++) {
+        const struct schema_struct *st = &structs[i];
+        char up[GEN_MAX_NAME], fup[GEN_MAX_NAME];
+
+        if (!st->blob)
+            continue;
+        upper(up, st->name);
+        emit("\n// ============== %s ==============\n", st->name);
+        emit("enum {\n");
+        for (unsigned int f = 0; f < st->n; f++) {
+            upper(fup, st->fields[f].name);
+            emit("    %s_%s,\n", up, fup);
+        }
+        emit("    __%s_MAX,\n};\n\n", up);
+
+        emit("extern const struct blobmsg_policy %s_policy[__%s_MAX];\n\n", st->name, up);
+        emit("// Strings point into 'msg'. RPC_JSON_OK or RPC_JSON_MISSING.\n");
+        emit("int %s_from_blob(struct %s *s, struct blob_attr *msg);\n", st->name, st->name);
+        emit("int %s_to_blob(struct blob_buf *b, const struct %s *s);\n", st->name, st->name);
+    }
+
+    emit("\n#endif\n");
+}
+
+static void emit_blob_source(void)
+{
+    emit("#include <string.h>\n"
+         "#include \"rpc_schema_blob.h\"\n");
+
+    for (unsigned int i = 0; i < n_structs; i++) {
+        const struct schema_struct *st = &structs[i];
+        const char *n = st->name;
+        char up[GEN_MAX_NAME], fup[GEN_MAX_NAME];
+
+        if (!st->blob)
+            continue;
+        upper(up, n);
+        emit("\n// ============== %s ==============\n", n);
+
+        emit("const struct blobmsg_policy %s_policy[__%s_MAX] = {\n", n, up);
+        for (unsigned int f = 0; f < st->n; f++) {
+            upper(fup, st->fields[f].name);
+            emit("    [%s_%s] = {.name = \"%s\", .type = %s},\n",
+                 up, fup, st->fields[f].name, blob_types[st->fields[f].type]);
+        }
+        emit("};\n\n");
+
+        emit("int %s_from_blob(struct %s *s, struct blob_attr *msg)\n"
+             "{\n"
+             "    struct blob_attr *tb[__%s_MAX];\n\n"
+             "    memset(s, 0, sizeof(*s));\n"
+             "    blobmsg_parse(%s_policy, __%s_MAX, tb, blob_data(msg), blob_len(msg));\n\n",
+             n, n, up, n, up);
+        for (unsigned int f = 0; f < st->n; f++) {
+            const struct field *fl = &st->fields[f];
+            upper(fup, fl->name);
+            emit("    if (tb[%s_%s]) {\n", up, fup);
+            switch (fl->type) {
+            case TYPE_STRING:
+                emit("        s->%s = blobmsg_get_string(tb[%s_%s]);\n", fl->name, up, fup);
+                break;
+            case TYPE_INT:
+                emit("        s->%s = (int)blobmsg_get_u32(tb[%s_%s]);\n", fl->name, up, fup);
+                break;
+            case TYPE_BOOL:
+                emit("        s->%s = blobmsg_get_bool(tb[%s_%s]);\n", fl->name, up, fup);
+                break;
+            case TYPE_RAW:
+                break;
+            }
+            emit("        s->present |= %s_HAS_%s;\n"
+                 "    }\n", up, fup);
+        }
+        emit("\n    return (s->present & %s_REQUIRED) == %s_REQUIRED ? RPC_JSON_OK : RPC_JSON_MISSING;\n"
+             "}\n\n", up, up);
+
+        emit("int %s_to_blob(struct blob_buf *b, const struct %s *s)\n"
+             "{\n"
+             "    int ret = 0;\n\n", n, n);
+        for (unsigned int f = 0; f < st->n; f++) {
+            const struct field *fl = &st->fields[f];
+            upper(fup, fl->name);
+            switch (fl->type) {
+            case TYPE_STRING:
+                emit("    if ((s->present & %s_HAS_%s) && s->%s)\n"
+                     "        ret |= blobmsg_add_string(b, \"%s\", s->%s);\n",
+                     up, fup, fl->name, fl->name, fl->name);
+                break;
+            case TYPE_INT:
+                emit("    if (s->present & %s_HAS_%s)\n"
+                     "        ret |= blobmsg_add_u32(b, \"%s\", (uint32_t)s->%s);\n",
+                     up, fup, fl->name, fl->name);
+                break;
+            case TYPE_BOOL:
+                emit("    if (s->present & %s_HAS_%s)\n"
+                     "        ret |= blobmsg_add_u8(b, \"%s\", s->%s);\n",
+                     up, fup, fl->name, fl->name);
+                break;
+            case TYPE_RAW:
+                break;
+            }
+        }
+        emit("    return ret ? -1 : 0;\n"
+             "}\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s schema outdir\n", argv[0]);
+        return 2;
+    }
+    schema_path = argv[1];
+
+    FILE *f = fopen(schema_path, "r");
+    if (!f)
+        die(0, "cannot open %s", schema_path);
+    parse_schema(f);
+    fclose(f);
+
+    check_schema();
+    for (unsigned int i = 0; i < n_structs; i++)
+        find_hash(&structs[i]);
+
+    static const struct {
+        const char *name;
+        void (*emit)(void);
+    } files[] = {
+        {"rpc_schema.h",        emit_header},
+        {"rpc_schema.c",        emit_source},
+        {"rpc_schema_blob.h",   emit_blob_header},
+        {"rpc_schema_blob.c",   emit_blob_source},
+    };
+
+    for (unsigned int i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char tmp[512], final[512];
+        open_out(argv[2], files[i].name, tmp, final);
+        files[i].emit();
+        close_out(tmp, final);
+    }
+    return 0;
+}
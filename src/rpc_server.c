@@ -5,19 +5,182 @@
 #include <sys/un.h>
 #include <errno.h>
 #include <unistd.h>
-#include <json-c/json.h>
+#include <poll.h>
+#include <signal.h>
 #include "log.h"
+#include "rpc_protocol.h"
+#include "trace.h"
+#include "payload.h"
+#include "rpc_schema.h"
 
-#define SOCKET_PATH "/tmp/greet_rpc.sock"
+#define RPC_SERVER_READ_CHUNK   2048
+#define RPC_SERVER_MAX_LINE     (1024 * 1024)   // larger requests come as a memfd
+#define RPC_SERVER_GREETING     "Hello From RPC!"
 
-int main()
+// Environment:
+//   RPC_SERVER_REPLY_BYTES   pad result.message to this length, to exercise
+//                            large replies (default 0, the bare greeting)
+//   RPC_SERVER_STREAM_CHUNK  for a request with "stream":true, send a message
+//                            longer than this as partial frames of at most this
+//                            many bytes of text, then a bare final frame
+//                            (default 0, never stream)
+static struct {
+    size_t reply_bytes;
+    size_t stream_chunk;
+} cfg;
+
+static size_t env_size(const char *name)
+{
+    const char *val = getenv(name);
+    return val && *val ? (size_t)strtoull(val, NULL, 10) : 0;
+}
+
+// Read one request line (without '\n') into '*buf', growing it as needed.
+// Fds that arrive with it are queued in 'fds'. Returns its length or -1.
+static ssize_t read_request(int fd, char **buf, size_t *cap, struct payload_fds *fds)
+{
+    size_t len = 0;
+
+    while (1) {
+        if (*cap - len < RPC_SERVER_READ_CHUNK) {
+            char *grown = realloc(*buf, *cap * 2);
+            if (!grown)
+                return -1;
+            *buf = grown;
+            *cap *= 2;
+        }
+
+        ssize_t n = payload_recv(fd, *buf + len, *cap - len - 1, fds);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return len ? (ssize_t)len : -1;
+
+        char *nl = memchr(*buf + len, '\n', n);
+        len += n;
+        if (nl)
+            return nl - *buf;
+        if (len > RPC_SERVER_MAX_LINE) {
+            log_error("Request line over %d bytes", RPC_SERVER_MAX_LINE);
+            return -1;
+        }
+    }
+}
+
+// The greet.welcome message, padded to RPC_SERVER_REPLY_BYTES (malloc'd)
+static char *build_message(size_t *len)
+{
+    size_t base = sizeof(RPC_SERVER_GREETING) - 1;
+    size_t n = cfg.reply_bytes > base ? cfg.reply_bytes : base;
+    char *message = malloc(n + 1);
+
+    if (message) {
+        memcpy(message, RPC_SERVER_GREETING, base);
+        memset(message + base, '.', n - base);
+        message[n] = '\0';
+        *len = n;
+    }
+    return message;
+}
+
+// greet.welcome result object for 'len' bytes of 'message' (malloc'd)
+static char *build_result(const char *message, size_t len, size_t *result_len)
 {
+    char *text = strndup(message, len);
+    if (!text)
+        return NULL;
+
+    struct greet_welcome_result result = {
+        .message = text,
+        .present = GREET_WELCOME_RESULT_HAS_MESSAGE,
+    };
+    struct rpc_jbuf jb;
+    rpc_jbuf_init(&jb, len + 16);
+    greet_welcome_result_write(&jb, &result);
+    free(text);
+    return rpc_jbuf_finish(&jb, result_len);
+}
+
+// Serialize one reply line with the generated writer and send it; a large
+// line goes out as a memfd if the caller takes one. Returns 0 or -1.
+static int write_reply(int fd, const struct rpc_reply *reply, size_t size_hint, bool accept_fd)
+{
+    struct rpc_jbuf jb;
+    size_t line_len = 0;
+
+    rpc_jbuf_init(&jb, size_hint + 64);
+    rpc_reply_write(&jb, reply);
+    rpc_jbuf_char(&jb, '\n');
+    char *line = rpc_jbuf_finish(&jb, &line_len);
+    if (!line)
+        return -1;
+
+    int ret = payload_write_line(fd, line, line_len, accept_fd);
+    log_debug("Sent RPC response: %.*s", (int)(line_len - 1), line);
+    free(line);
+    return ret;
+}
+
+// Streamed reply: each chunk of the message is a partial frame holding its
+// own result object, then a final frame with "result":null. The socket is
+// blocking, so the server runs at the pace the bridge reads.
+static void stream_message(int fd, int id, const char *message, size_t len, bool accept_fd)
+{
+    unsigned int parts = 0;
+
+    for (size_t off = 0; off < len; off += cfg.stream_chunk)
+    {
+        size_t chunk = len - off < cfg.stream_chunk ? len - off : cfg.stream_chunk;
+        size_t partial_len = 0;
+        char *partial = build_result(message + off, chunk, &partial_len);
+        if (!partial)
+            return;
+
+        struct rpc_reply frame = {
+            .id = id,
+            .partial = partial,
+            .partial_len = partial_len,
+            .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_PARTIAL,
+        };
+        int ret = write_reply(fd, &frame, partial_len, accept_fd);
+        free(partial);
+        if (ret < 0)
+        {
+            // A hedged copy the bridge cancelled, or the caller went away
+            log_warn("Streamed reply cut after %u partial frames", parts);
+            return;
+        }
+        parts++;
+    }
+
+    struct rpc_reply final = {
+        .id = id,
+        .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_RESULT | RPC_REPLY_HAS_ERROR,
+    };
+    write_reply(fd, &final, 0, false);
+    log_debug("Streamed %zu bytes in %u partial frames", len, parts);
+}
+
+// Usage: rpc_server [socket_path]   (default RPC_SOCK_PATH; run one process
+// per path to give the bridge several upstream instances, see RPC_UPSTREAMS)
+int main(int argc, char *argv[])
+{
+    const char *socket_path = argc > 1 ? argv[1] : RPC_SOCK_PATH;
     int server_fd;
     int client_fd;
     struct sockaddr_un addr = {0};
 
     log_info("Starting RPC server...");
 
+    trace_init("rpc_server");
+    payload_config_load();
+    cfg.reply_bytes = env_size("RPC_SERVER_REPLY_BYTES");
+    cfg.stream_chunk = env_size("RPC_SERVER_STREAM_CHUNK");
+
+    // The bridge cancels the slower copy of a hedged request by closing its
+    // socket; replying to it must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
     // Create socket
     server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (server_fd < 0)
@@ -29,16 +192,16 @@ int main()
 
     // Bind to path
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
 
-    unlink(SOCKET_PATH);
+    unlink(socket_path);
     if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
     {
         log_error("bind() failed: %s", strerror(errno));
         close(server_fd);
         return 1;
     }
-    log_debug("Socket bound to %s", SOCKET_PATH);
+    log_debug("Socket bound to %s", socket_path);
 
     // listen for connections on a socket
     if (listen(server_fd, 5) < 0)
@@ -48,11 +211,31 @@ int main()
         return 1;
     }
 
-    log_info("RPC server listening on %s (one request per connection)", SOCKET_PATH);
+    log_info("RPC server listening on %s (one request per connection)", socket_path);
+
+    size_t buf_cap = RPC_SERVER_READ_CHUNK * 2;
+    char *buf = malloc(buf_cap);
+    if (!buf)
+    {
+        log_error("Out of memory");
+        close(server_fd);
+        return 1;
+    }
 
     // Loop
     while (1)
     {
+        // poll() always returns EINTR on a signal, so a SIGUSR1 trace dump is
+        // served even while the server is idle
+        struct pollfd pfd = {.fd = server_fd, .events = POLLIN};
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno != EINTR)
+                log_error("poll() failed: %s", strerror(errno));
+            trace_poll();
+            continue;
+        }
+
         client_fd = accept(server_fd, NULL, NULL);
         if (client_fd < 0)
         {
@@ -61,93 +244,175 @@ int main()
         }
 
         log_debug("Client connected (fd=%d)", client_fd);
+
+        uint64_t t_start = trace_now_ns();
+        uint64_t trace_id = 0;
         
-        char buf[2048];
-        ssize_t n = read(client_fd, buf, sizeof(buf) - 1);
+        struct payload_fds fds = {0};
+        ssize_t n = read_request(client_fd, &buf, &buf_cap, &fds);
+        uint64_t t_read = trace_now_ns();
         
         if (n <= 0)
         {
             log_warn("Client closed without sending data");
+            payload_fds_close(&fds);
             close(client_fd);
             continue;
         }
 
-        buf[n] = '\0';
-        log_debug("Received %zd bytes from client", n);
+        // A large request is an envelope for a sealed memfd: parse it in place
+        const char *req_data = buf;
+        size_t req_len = n;
+        size_t size;
+        struct payload_map map = {0};
+        if (payload_is_envelope(buf, n, &size))
+        {
+            if (payload_map_next(&fds, size, &map) < 0)
+            {
+                payload_fds_close(&fds);
+                close(client_fd);
+                continue;
+            }
+            req_data = map.data;
+            req_len = map.len;
+        }
+        payload_fds_close(&fds);
+        log_debug("Received %zu bytes from client%s", req_len, map.data ? " (memfd)" : "");
 
-        // JSON Parsing 
-        json_object *root = json_tokener_parse(buf);
-        if (!root)
+        // JSON Parsing with the readers generated from schema/rpc.schema. Raw
+        // members such as req.params point into the input, so a memfd stays
+        // mapped until the request is freed.
+        struct rpc_request req;
+        struct greet_welcome_params params = {0};
+        int parse_ret = rpc_request_read(&req, req_data, req_len);
+        int params_ret = RPC_JSON_MISSING;
+        if (parse_ret != RPC_JSON_INVALID && (req.present & RPC_REQUEST_HAS_PARAMS))
+        {
+            params_ret = greet_welcome_params_read(&params, req.params, req.params_len);
+        }
+        if (parse_ret == RPC_JSON_INVALID)
         {
             log_error("Invalid JSON received");
+            rpc_request_free(&req);
+            payload_unmap(&map);
             close(client_fd);
             continue;
         }
 
-        // Extract fields 
-        json_object *id_obj = NULL;
-        json_object *method_obj = NULL;
-        json_object *params_obj = NULL;
+        bool accept_fd = req.accept_fd;
 
-        json_object_object_get_ex(root, "id", &id_obj);
-        json_object_object_get_ex(root, "method", &method_obj);
-        json_object_object_get_ex(root, "params", &params_obj);
-
-        int id = 0;
-        const char *method = NULL;
-        json_object *name_obj = NULL;
-
-        // Validates RPC structure
-        if (id_obj && json_object_get_type(id_obj) == json_type_int)
+        // Join the caller's trace; requests without one get a local id
+        if (req.present & RPC_REQUEST_HAS_TRACE_ID)
         {
-            id = json_object_get_int(id_obj);
+            trace_id = trace_id_from_str(req.trace_id);
         }
-            
-        if (method_obj && json_object_get_type(method_obj) == json_type_string)
+        if (!trace_id)
         {
-            method = json_object_get_string(method_obj);
+            trace_id = trace_new_id();
         }
 
-        if (params_obj && json_object_object_get_ex(params_obj, "name", &name_obj))
+        // Absent or mistyped members stay 0 / NULL
+        int id = req.id;
+        const char *method = req.method;
+
+        uint64_t t_parse = trace_now_ns();
+        trace_span(trace_id, "server.read", t_start, t_read);
+        trace_span(trace_id, "server.parse", t_read, t_parse);
+
+        if (method && strcmp(method, RPC_PING_METHOD) == 0)
+        {
+            // Health probe from the bridge's circuit breaker
+            static const char pong[] = "{\"pong\":true}";
+            struct rpc_reply reply = {
+                .id = id,
+                .result = pong,
+                .result_len = sizeof(pong) - 1,
+                .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_RESULT | RPC_REPLY_HAS_ERROR,
+            };
+            write_reply(client_fd, &reply, 0, false);
+            log_debug("Answered %s", RPC_PING_METHOD);
+        }
+        else if (params_ret == RPC_JSON_OK)
         {
-            const char *name = json_object_get_string(name_obj);
-            log_info("RPC request: id=%d method='%s' name='%s'", id, method, name);
-
-            // Build reply
-            json_object *reply = json_object_new_object();
-            json_object_object_add(reply, "id", json_object_new_int(id));
-            json_object *result = json_object_new_object();
-            json_object_object_add(result, "message", 
-                json_object_new_string("Hello From RPC!"));
-            json_object_object_add(reply, "result", result);
-            json_object_object_add(reply, "error", NULL);
-
-            // Serializes back to string 
-            const char *reply_str = json_object_to_json_string(reply);
-            write(client_fd, reply_str, strlen(reply_str));
-            write(client_fd, "\n", 1);
-
-            log_debug("Sent RPC response: %s", reply_str);
-            json_object_put(reply);
+            log_info("RPC request: id=%d method='%s' name='%s'", id, method, params.name);
+
+            // Build reply with the generated writers
+            size_t message_len = 0;
+            char *message = build_message(&message_len);
+            uint64_t t_handle = trace_now_ns();
+            trace_span(trace_id, "server.handle", t_parse, t_handle);
+            uint64_t t_ser = t_handle;
+
+            if (message && req.stream && cfg.stream_chunk && message_len > cfg.stream_chunk)
+            {
+                stream_message(client_fd, id, message, message_len, accept_fd);
+            }
+            else if (message)
+            {
+                size_t result_len = 0;
+                char *result_json = build_result(message, message_len, &result_len);
+
+                // Serializes back to string, "error":null included
+                struct rpc_reply reply = {
+                    .id = id,
+                    .result = result_json,
+                    .result_len = result_len,
+                    .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_RESULT | RPC_REPLY_HAS_ERROR,
+                };
+                t_ser = trace_now_ns();
+                trace_span(trace_id, "server.serialize", t_handle, t_ser);
+
+                // One write; a large reply goes out as a memfd if the caller takes one
+                if (result_json)
+                {
+                    write_reply(client_fd, &reply, result_len, accept_fd);
+                    free(result_json);
+                }
+            }
+            free(message);
+            trace_span(trace_id, "server.write", t_ser, trace_now_ns());
         }
         else
         {
             log_error("Invalid RPC request format - missing 'name' parameter");
             
-            // Send error response
-            char error_buf[256];
-            snprintf(error_buf, sizeof(error_buf),
-                "{\"id\":%d,\"result\":null,\"error\":{\"code\":400,\"message\":\"Invalid request format\"}}\n",
-                id);
-            write(client_fd, error_buf, strlen(error_buf));
+            // Send error response, "result":null included
+            struct rpc_error error = {
+                .code = 400,
+                .message = "Invalid request format",
+                .present = RPC_ERROR_HAS_CODE | RPC_ERROR_HAS_MESSAGE,
+            };
+            struct rpc_jbuf jb;
+            size_t error_len = 0;
+            rpc_jbuf_init(&jb, 64);
+            rpc_error_write(&jb, &error);
+            char *error_json = rpc_jbuf_finish(&jb, &error_len);
+            if (error_json)
+            {
+                struct rpc_reply reply = {
+                    .id = id,
+                    .error = error_json,
+                    .error_len = error_len,
+                    .present = RPC_REPLY_HAS_ID | RPC_REPLY_HAS_RESULT | RPC_REPLY_HAS_ERROR,
+                };
+                write_reply(client_fd, &reply, error_len, false);
+                free(error_json);
+            }
         }
 
-        json_object_put(root);
+        rpc_request_free(&req);
+        greet_welcome_params_free(&params);
+        payload_unmap(&map);
         close(client_fd);
+
+        trace_span(trace_id, "server.request", t_start, trace_now_ns());
+        trace_poll();
     }
 
     log_info("Shutting down RPC server...");
+    free(buf);
     close(server_fd);
-    unlink(SOCKET_PATH);
+    unlink(socket_path);
+    trace_shutdown();
     return 0;
 }
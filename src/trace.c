@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+#include "trace.h"
+
+struct trace_span_rec {
+    uint64_t trace_id;
+    const char *name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+static struct trace_span_rec ring[TRACE_RING_SIZE];
+static uint64_t ring_count;     // total spans ever recorded; slot = count % size
+
+static const char *proc_name = "unknown";
+static int proc_pid;
+static char dump_path[256];
+
+static FILE *stream_fp;         // continuous export, NULL when disabled
+static unsigned long sample_every = 1;
+
+static volatile sig_atomic_t dump_requested;
+
+static void trace_sigusr1(int sig)
+{
+    (void)sig;
+    dump_requested = 1;
+}
+
+uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// splitmix64 finalizer: spreads pid/time/counter bits over the whole id so
+// "id % N" sampling picks the same traces in every process
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint64_t trace_new_id(void)
+{
+    static uint64_t counter;
+    uint64_t id;
+
+    do {
+        id = mix64(((uint64_t)proc_pid << 40) ^ trace_now_ns() ^ ++counter);
+    } while (id == 0);
+
+    return id;
+}
+
+void trace_id_to_str(uint64_t id, char buf[TRACE_ID_STR_LEN])
+{
+    snprintf(buf, TRACE_ID_STR_LEN, "%016llx", (unsigned long long)id);
+}
+
+uint64_t trace_id_from_str(const char *str)
+{
+    if (!str)
+        return 0;
+    return strtoull(str, NULL, 16);
+}
+
+// Chrome "complete" event; timestamps are in microseconds
+static void write_event(FILE *fp, const struct trace_span_rec *s)
+{
+    char id_str[TRACE_ID_STR_LEN];
+    trace_id_to_str(s->trace_id, id_str);
+
+    fprintf(fp, "{\"name\":\"%s\",\"cat\":\"rpc\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"trace_id\":\"%s\"}}",
+            s->name,
+            (unsigned long long)(s->start_ns / 1000), (unsigned)(s->start_ns % 1000),
+            (unsigned long long)((s->end_ns - s->start_ns) / 1000),
+            (unsigned)((s->end_ns - s->start_ns) % 1000),
+            proc_pid, proc_pid, id_str);
+}
+
+static void write_process_name(FILE *fp)
+{
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+            proc_pid, proc_name);
+}
+
+void trace_span(uint64_t trace_id, const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    struct trace_span_rec *s = &ring[ring_count % TRACE_RING_SIZE];
+
+    s->trace_id = trace_id;
+    s->name = name;
+    s->start_ns = start_ns;
+    s->end_ns = end_ns < start_ns ? start_ns : end_ns;
+    ring_count++;
+
+    if (stream_fp && trace_id % sample_every == 0) {
+        // JSON array format; Chrome accepts the array without a closing ']'
+        fputs(",\n", stream_fp);
+        write_event(stream_fp, s);
+    }
+}
+
+int trace_dump(const char *path)
+{
+    if (!path)
+        path = dump_path;
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        log_error("trace: cannot open %s for writing", path);
+        return -1;
+    }
+
+    uint64_t first = ring_count > TRACE_RING_SIZE ? ring_count - TRACE_RING_SIZE : 0;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", fp);
+    write_process_name(fp);
+    for (uint64_t i = first; i < ring_count; i++) {
+        fputs(",\n", fp);
+        write_event(fp, &ring[i % TRACE_RING_SIZE]);
+    }
+    fputs("\n]}\n", fp);
+    fclose(fp);
+
+    log_info("trace: dumped %llu spans to %s",
+             (unsigned long long)(ring_count - first), path);
+    return 0;
+}
+
+void trace_poll(void)
+{
+    if (stream_fp)
+        fflush(stream_fp);
+
+    if (dump_requested) {
+        dump_requested = 0;
+        trace_dump(NULL);
+    }
+}
+
+void trace_init(const char *process_name)
+{
+    proc_name = process_name;
+    proc_pid = getpid();
+
+    const char *env = getenv(TRACE_ENV_DUMP);
+    if (env && *env)
+        snprintf(dump_path, sizeof(dump_path), "%s", env);
+    else
+        snprintf(dump_path, sizeof(dump_path), "/tmp/%s.trace.json", process_name);
+
+    env = getenv(TRACE_ENV_SAMPLE);
+    if (env && strtoul(env, NULL, 10) > 0)
+        sample_every = strtoul(env, NULL, 10);
+
+    env = getenv(TRACE_ENV_FILE);
+    if (env && *env) {
+        stream_fp = fopen(env, "w");
+        if (!stream_fp) {
+            log_error("trace: cannot open %s, continuous export disabled", env);
+        } else {
+            fputs("[\n", stream_fp);
+            write_process_name(stream_fp);
+            log_info("trace: streaming 1/%lu traces to %s", sample_every, env);
+        }
+    }
+
+    // SA_RESTART keeps in-flight read()/write() calls intact; the dump itself
+    // is done later from trace_poll(), never from signal context
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_sigusr1;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    log_debug("trace: ring of %d spans, SIGUSR1 dumps to %s", TRACE_RING_SIZE, dump_path);
+}
+
+void trace_shutdown(void)
+{
+    if (stream_fp) {
+        fputs("\n]\n", stream_fp);
+        fclose(stream_fp);
+        stream_fp = NULL;
+    }
+}
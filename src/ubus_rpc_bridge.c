@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // struct ucred (SO_PEERCRED)
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -10,90 +11,235 @@
 #include <libubox/blobmsg_json.h>
 #include <libubox/uloop.h>
 #include "log.h"
-
-// SOCKET PATHS DEFINES
-#define RPC_SOCK_PATH "/tmp/greet_rpc.sock"
-#define BRIDGE_SOCK_PATH "/tmp/bridge_rpc.sock"
+#include "rpc_protocol.h"
+#include "rpc_codec.h"
+#include "rpc_schema_blob.h"
+#include "trace.h"
+#include "capture.h"
+#include "upstream_pool.h"
+#include "payload.h"
+#include "bridge_sched.h"
+#include "bridge_conn.h"
+
+#define BRIDGE_UBUS_TIMEOUT_MS 3000
 
 static struct ubus_context *ubus_ctx;
 static int bridge_listener_fd = -1;
+static struct upstream_pool rpc_pool;
+
+// ============== DIRECTION B: ubus -> RPC ==============
+// One deferred rpc_greet.welcome call, alive from the ubus handler until the reply
+struct rpc_greet_request {
+    struct sched_job job;
+    struct ubus_request_data req;   // deferred ubus request
+    struct pool_call call;
+    uint64_t trace_id;
+    uint64_t t_start;
+    char *rpc_request;      // JSON-RPC line, handed to the upstream call
+    size_t rpc_request_len;
+    char *payload_json;     // only kept while capturing
+    struct capture_parts parts;     // streamed replies, only while capturing
+    char *hash_key;         // RPC_BALANCE=hash param value, if present
+    unsigned int partials;  // streamed replies already sent to the ubus caller
+    int final_ret;          // rpc_read_reply() of the final frame, once read
+    bool final_read;
+    struct greet_welcome_result welcome;    // final frame's result
+};
 
-// ============== RPC CLIENT ==============
-// it sends JSON-RPC request to rpc_server (Connect to /tmp/greet_rpc.sock, send JSON-RPC, receive response)
-int rpc_call(const char *method, const char *name, int id, char **reply_str)
+// 'parts' holds the messages already streamed to the caller, or is NULL
+static void rpc_greet_capture(const char *payload_json, struct capture_parts *parts,
+                              struct blob_attr *reply, int status, uint64_t t_start, uint64_t t_end)
 {
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd < 0)
-    {
-        log_error("rpc_call: socket() failed");
-        return -1;
+    char *reply_json = reply ? blobmsg_format_json(reply, true) : NULL;
+    bool streamed = parts && parts->count;
+
+    if (streamed && reply_json) {
+        capture_parts_add(parts, reply_json, strlen(reply_json));
     }
+    const char *data = streamed ? parts->data : reply_json;
 
-    struct sockaddr_un addr = {0};
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, RPC_SOCK_PATH, sizeof(addr.sun_path) - 1);
+    capture_record(CAPTURE_DIR_B, "rpc_greet.welcome",
+                   payload_json, payload_json ? strlen(payload_json) : 0,
+                   data, data ? strlen(data) : 0,
+                   status, t_start, t_end - t_start, streamed);
+    free(reply_json);
+}
 
-    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
-    {
-        log_error("rpc_call: connect() failed - RPC server unreachable");
-        close(fd);
-        return -1;
+// Send the (optional) reply, complete the deferred request and release it
+static void rpc_greet_complete(struct rpc_greet_request *r, int status, struct blob_attr *reply)
+{
+    if (reply) {
+        ubus_send_reply(ubus_ctx, &r->req, reply);  // Send ubus reply
     }
+    ubus_complete_deferred_request(ubus_ctx, &r->req, status);
 
-    log_debug("Connected to RPC server at %s", RPC_SOCK_PATH);
+    uint64_t t_end = trace_now_ns();
+    trace_span(r->trace_id, "bridge.ubus_to_rpc", r->t_start, t_end);
+    if (r->payload_json) {
+        rpc_greet_capture(r->payload_json, &r->parts, reply, status, r->t_start, t_end);
+    }
 
-    // Build JSON Req to send : '{"id":1,"method":"greet.welcome","params":{"name":"Shripad"}}'
+    if (r->job.dispatch_ns) {
+        sched_done(&r->job);
+    }
+    free(r->rpc_request);
+    free(r->payload_json);
+    capture_parts_free(&r->parts);
+    free(r->hash_key);
+    greet_welcome_result_free(&r->welcome);
+    free(r);
+}
 
-    // Build JSON-RPC request
-    json_object *req = json_object_new_object();   // Create empty JSON object
-    json_object_object_add(req, "id", json_object_new_int(id)); // Create JSON integer and Add key-value pair to JSON
-    json_object_object_add(req, "method", json_object_new_string(method));  // // Create JSON string and Add key-value pair to JSON
-    json_object *params = json_object_new_object();
-    json_object_object_add(params, "name", json_object_new_string(name));
-    json_object_object_add(req, "params", params);
+// Streamed upstream reply: forward each partial frame to the ubus caller as
+// its own reply message as soon as it arrives. ubus_send_reply() returns once
+// ubusd has the message, so the upstream socket is read at the caller's pace.
+// The final frame is read here too, and rpc_greet_reply_cb uses that result.
+static int rpc_greet_line_cb(struct pool_call *call, const char *line, size_t len)
+{
+    struct rpc_greet_request *r = container_of(call, struct rpc_greet_request, call);
+    struct rpc_reply frame;
+    struct greet_welcome_result welcome;
+
+    uint64_t t0 = trace_now_ns();
+    int ret = rpc_read_reply(line, len, &frame, &welcome);
+    if (!(frame.present & RPC_REPLY_HAS_PARTIAL)) {
+        rpc_reply_free(&frame);     // welcome.message is a decoded copy
+        greet_welcome_result_free(&r->welcome);
+        r->welcome = welcome;
+        r->final_ret = ret;
+        r->final_read = true;
+        trace_span(r->trace_id, "reply.parse", t0, trace_now_ns());
+        return 1;   // final reply, completed by rpc_greet_reply_cb
+    }
+    greet_welcome_result_free(&welcome);
 
-    const char *req_json = json_object_to_json_string(req); // Serialize JSON to string
-    ssize_t n_written = write(fd, req_json, strlen(req_json));  // Send data to socket
-    write(fd, "\n", 1);
+    // The partial's contents have no schema, only that slice is parsed generically
+    json_object *partial = rpc_parse(frame.partial, frame.partial_len);
+    struct blob_buf b = {};
+    blob_buf_init(&b, 0);
+    if (json_object_get_type(partial) == json_type_object) {
+        blobmsg_add_object(&b, partial);
+    } else {
+        blobmsg_add_json_element(&b, RPC_PARTIAL_KEY, partial);
+    }
 
-    log_debug("Sent RPC request: %s", req_json);
-    json_object_put(req);   // Free JSON object (refcount--)
+    ubus_send_reply(ubus_ctx, &r->req, b.head);
+    r->partials++;
+    if (r->payload_json) {
+        char *json = blobmsg_format_json(b.head, true);
+        if (json) {
+            capture_parts_add(&r->parts, json, strlen(json));
+        }
+        free(json);
+    }
+    trace_span(r->trace_id, "reply.partial", t0, trace_now_ns());
+    log_debug("Direction B: Forwarded partial reply %u (%zu bytes)", r->partials, len);
+
+    blob_buf_free(&b);
+    json_object_put(partial);
+    rpc_reply_free(&frame);
+    return 0;
+}
+
+// Upstream reply (or failure) for a dispatched rpc_greet.welcome call
+static void rpc_greet_reply_cb(struct pool_call *call, int result)
+{
+    struct rpc_greet_request *r = container_of(call, struct rpc_greet_request, call);
 
-    if (n_written < 0)
+    if (result == UPSTREAM_TIMEOUT)
     {
-        log_error("rpc_call: write() failed");
-        close(fd);
-        return -1;
+        log_error("Direction B: RPC server timed out");
+        rpc_greet_complete(r, UBUS_STATUS_TIMEOUT, NULL);
+        return;
+    }
+    if (result < 0)
+    {
+        log_error("Direction B: RPC server unreachable or call failed");
+        rpc_greet_complete(r, UBUS_STATUS_UNKNOWN_ERROR, NULL);
+        return;
     }
 
-    // Read response
-    char buf[2048];
-    ssize_t n = read(fd, buf, sizeof(buf) - 1); // Receive data from socket
-    close(fd);
+    log_debug("Direction B: RPC reply JSON from %s: %.*s", call->winner->path,
+              (int)call->reply_len, call->reply);
 
-    if (n <= 0)
+    // The final line was read by rpc_greet_line_cb; only a reply that ended
+    // at EOF without a newline is parsed here (in place, also from a memfd)
+    if (!r->final_read)
     {
-        log_error("rpc_call: read() failed or empty response");
-        return -1;
+        uint64_t t1 = trace_now_ns();
+        struct rpc_reply reply;
+        r->final_ret = rpc_read_reply(call->reply, call->reply_len, &reply, &r->welcome);
+        rpc_reply_free(&reply);     // welcome.message is a decoded copy
+        trace_span(r->trace_id, "reply.parse", t1, trace_now_ns());
     }
+    pool_call_free(call);
 
-    buf[n] = '\0';
-    *reply_str = strdup(buf);   // Duplicate string (malloc)
-    log_debug("Received RPC response (%zd bytes)", n);
-    return 0;
-}
+    if (r->final_ret == RPC_JSON_INVALID)
+    {
+        log_error("Direction B: Failed to parse RPC reply JSON");
+        rpc_greet_complete(r, UBUS_STATUS_UNKNOWN_ERROR, NULL);
+        return;
+    }
 
-// ============== DIRECTION B: ubus -> RPC ==============
-enum {
-    RPC_GREET_NAME,     // Index 0 for "name" parameter
-    __RPC_GREET_MAX,    // Array size
-};
+    struct greet_welcome_result *welcome = &r->welcome;
+    const char *message = r->final_ret == RPC_JSON_OK ? welcome->message : NULL;
+    uint64_t t2 = trace_now_ns();
+
+    // A streamed reply may end with a bare final frame; its data went out already
+    if (!message && r->partials)
+    {
+        log_info("Direction B: Streamed %u partial replies", r->partials);
+        rpc_greet_complete(r, UBUS_STATUS_OK, NULL);
+        return;
+    }
+
+    // Build ubus reply
+    struct blob_buf b = {};
+    blob_buf_init(&b, 0);   // Initialize blob buffer
+
+    if (message)
+    {
+        log_info("Direction B: Sending ubus reply: %s", message);
+    } 
+    else
+    {
+        log_error("Direction B: RPC response missing result.message");
+        welcome->message = "Error: Invalid RPC response";
+        welcome->present |= GREET_WELCOME_RESULT_HAS_MESSAGE;
+    }
+    greet_welcome_result_to_blob(&b, welcome);
+    trace_span(r->trace_id, "reply.build", t2, trace_now_ns());
+
+    rpc_greet_complete(r, UBUS_STATUS_OK, b.head);
+    blob_buf_free(&b);
+}
 
-// set string type policy
-static const struct blobmsg_policy rpc_greet_policy[] =
+// Scheduler picked this call: start the upstream exchange
+static void rpc_greet_run(struct sched_job *job)
 {
-    [RPC_GREET_NAME] = {.name = "name", .type = BLOBMSG_TYPE_STRING}
-};
+    struct rpc_greet_request *r = container_of(job, struct rpc_greet_request, job);
+
+    trace_span(r->trace_id, "sched.queue", job->enqueue_ns, job->dispatch_ns);
+
+    int ret = pool_call_start(&r->call, &rpc_pool, r->hash_key, r->rpc_request, r->rpc_request_len,
+                              r->trace_id, rpc_greet_reply_cb);
+    r->rpc_request = NULL;  // owned by the call now
+
+    if (ret == UPSTREAM_OK)
+    {
+        pool_call_stream(&r->call, rpc_greet_line_cb);
+    }
+    else if (ret == UPSTREAM_REJECTED)
+    {
+        log_warn("Direction B: no upstream with a closed circuit, failing fast");
+        rpc_greet_complete(r, UBUS_STATUS_CONNECTION_FAILED, NULL);    // upstream known to be down
+    }
+    else if (ret < 0)
+    {
+        log_error("Direction B: RPC server unreachable or call failed");
+        rpc_greet_complete(r, UBUS_STATUS_UNKNOWN_ERROR, NULL);
+    }
+}
 
 /*
  * Called when "ubus call rpc_greet welcome" is invoked
@@ -104,83 +250,67 @@ static int rpc_greet_handler(struct ubus_context *ctx, struct ubus_object *obj,
 {
     (void)obj;      // Suppress warning of unused
     (void)method;
-    
-    struct blob_attr *tb[__RPC_GREET_MAX];
-    blobmsg_parse(rpc_greet_policy, __RPC_GREET_MAX, tb, blob_data(msg), blob_len(msg));    // Parse binary blob into array
 
-    if (!tb[RPC_GREET_NAME])
+    uint64_t trace_id = trace_new_id();
+    uint64_t t_start = trace_now_ns();
+    struct greet_welcome_params params;
+    int parse_ret = greet_welcome_params_from_blob(&params, msg);   // Parse binary blob into the params struct
+    trace_span(trace_id, "ubus.parse", t_start, trace_now_ns());
+
+    if (parse_ret != RPC_JSON_OK)
     {
         log_warn("Direction B: Missing 'name' parameter in rpc_greet.welcome");
+        if (capture_enabled()) {
+            char *payload_json = blobmsg_format_json(msg, true);
+            rpc_greet_capture(payload_json, NULL, NULL, UBUS_STATUS_INVALID_ARGUMENT, t_start,
+                              trace_now_ns());
+            free(payload_json);
+        }
         return UBUS_STATUS_INVALID_ARGUMENT;
     }
 
-    char *name = blobmsg_get_string(tb[RPC_GREET_NAME]);    // Extract string from blob
-    log_info("Direction B: ubus call rpc_greet.welcome received, name='%s'", name);
+    log_info("Direction B: ubus call rpc_greet.welcome received, name='%s'", params.name);
 
-    // Call RPC server via rpc_call()
-    char *rpc_reply = NULL;
-    if (rpc_call("greet.welcome", name, 1, &rpc_reply) < 0)     // rpc_call() : Send RPC request
+    struct rpc_greet_request *r = calloc(1, sizeof(*r));
+    if (!r)
     {
-        log_error("Direction B: RPC server unreachable or call failed");
-        return UBUS_STATUS_UNKNOWN_ERROR;
+        return UBUS_STATUS_NO_MEMORY;
     }
 
-    log_debug("Direction B: RPC reply JSON: %s", rpc_reply);
-
-    // Parse RPC JSON response
-    json_object *reply_obj = json_tokener_parse(rpc_reply);
-    free(rpc_reply);
-    
-    if (!reply_obj)
+    r->trace_id = trace_id;
+    r->t_start = t_start;
+    r->rpc_request = rpc_build_request(GREET_WELCOME_RPC, &params, 1, trace_id, &r->rpc_request_len);
+    if (!r->rpc_request)
     {
-        log_error("Direction B: Failed to parse RPC reply JSON");
-        return UBUS_STATUS_UNKNOWN_ERROR;
+        free(r);
+        return UBUS_STATUS_NO_MEMORY;
     }
-
-    json_object *result_obj = NULL;
-    json_object *message_obj = NULL;
-    const char *message = NULL;
-    
-    // extract result.message
-    if (json_object_object_get_ex(reply_obj, "result", &result_obj))
-    {
-        if (result_obj && !json_object_is_type(result_obj, json_type_null))
-        {
-            if (json_object_object_get_ex(result_obj, "message", &message_obj))
-            {
-                if (message_obj && json_object_get_type(message_obj) == json_type_string)
-                {
-                    message = json_object_get_string(message_obj);
-                }
-            }
-        }
+    if (capture_enabled()) {
+        r->payload_json = blobmsg_format_json(msg, true);
     }
 
-    // Build ubus reply
-    struct blob_buf b = {};
-    blob_buf_init(&b, 0);   // Initialize blob buffer
+    // Consistent hashing key, e.g. RPC_BALANCE_HASH_PARAM=name
+    const char *hash_param = upstream_pool_hash_param(&rpc_pool);
+    if (hash_param) {
+        struct blobmsg_policy key_policy = {.name = hash_param, .type = BLOBMSG_TYPE_STRING};
+        struct blob_attr *key = NULL;
 
-    if (message)
-    {
-        blobmsg_add_string(&b, "message", message); // Add string to blob
-        log_info("Direction B: Sending ubus reply: %s", message);
-    } 
-    else
-    {
-        blobmsg_add_string(&b, "message", "Error: Invalid RPC response");
-        log_error("Direction B: RPC response missing result.message");
+        blobmsg_parse(&key_policy, 1, &key, blob_data(msg), blob_len(msg));
+        if (key) {
+            r->hash_key = strdup(blobmsg_get_string(key));
+        }
     }
 
-    ubus_send_reply(ctx, req, b.head);  // Send ubus reply
-    blob_buf_free(&b);
-    json_object_put(reply_obj);
+    // Reply later, once the scheduler has forwarded the call and rpc_server answered
+    ubus_defer_request(ctx, req, &r->req);
+    sched_submit(&r->job, sched_classify(GREET_WELCOME_RPC, true, -1), rpc_greet_run);
 
     return UBUS_STATUS_OK;
 }
 
 // ubus Object Registration Structures
 static const struct ubus_method rpc_greet_methods[] = {
-    UBUS_METHOD("welcome", rpc_greet_handler, rpc_greet_policy),
+    UBUS_METHOD(GREET_WELCOME_UBUS_METHOD, rpc_greet_handler, greet_welcome_params_policy),
 };
 
 static struct ubus_object_type rpc_greet_type = {
@@ -196,11 +326,131 @@ static struct ubus_object rpc_greet_object = {  // Define ubus object metadata f
     .n_methods = 1,
 };
 
+// ============== BRIDGE STATS ==============
+/*
+ * Called when "ubus call rpc_bridge stats" is invoked
+*/
+static int bridge_stats_handler(struct ubus_context *ctx, struct ubus_object *obj,
+                                struct ubus_request_data *req, const char *method,
+                                struct blob_attr *msg)
+{
+    (void)obj;
+    (void)method;
+    (void)msg;
+
+    struct blob_buf b = {};
+    blob_buf_init(&b, 0);
+
+    upstream_pool_stats(&b, &rpc_pool);
+    sched_stats(&b);
+    bridge_conn_stats(&b);
+
+    ubus_send_reply(ctx, req, b.head);
+    blob_buf_free(&b);
+
+    return UBUS_STATUS_OK;
+}
+
+static const struct ubus_method bridge_methods[] = {
+    UBUS_METHOD_NOARG("stats", bridge_stats_handler),
+};
+
+static struct ubus_object_type bridge_type = {
+    .name = "rpc_bridge",
+    .methods = bridge_methods,
+    .n_methods = 1,
+};
+
+static struct ubus_object bridge_object = {
+    .name = "rpc_bridge",
+    .type = &bridge_type,
+    .methods = bridge_methods,
+    .n_methods = 1,
+};
+
 // ============== DIRECTION A: RPC -> ubus ==============
+// One bridged RPC request, alive from the line being read until its reply is
+// handed to the connection's reply slot
+struct bridge_request {
+    struct sched_job job;
+    struct ubus_request ureq;
+    struct uloop_timeout timer;     // ubus_invoke_async() has no timeout of its own
+    struct conn_slot *slot;
+    int id;
+    uint64_t trace_id;
+    uint64_t t_start;
+    uint64_t t_invoke;
+    struct blob_buf params;
+    char method[64];
+    char *result_json;      // greet.welcome reply formatted as JSON
+    char *request;          // only kept while capturing
+    size_t request_len;
+    struct capture_parts parts;     // partial frames sent, only while capturing
+    bool stream;            // client sent "stream":true
+    bool stream_failed;     // client fell behind, remaining messages dropped
+    unsigned int partials;
+};
+
+static void bridge_request_free(struct bridge_request *r)
+{
+    blob_buf_free(&r->params);
+    free(r->result_json);
+    free(r->request);
+    capture_parts_free(&r->parts);
+    free(r);
+}
+
+// Queue the reply (malloc'd, ownership passes to the connection), record the
+// exchange and release the request. The write itself is traced as client.write
+// by the connection once the coalesced flush has sent it.
+static void bridge_request_finish(struct bridge_request *r, char *reply, int status)
+{
+    size_t reply_len = reply ? strlen(reply) : 0;
+    uint64_t t_end = trace_now_ns();
+
+    trace_span(r->trace_id, "bridge.rpc_to_ubus", r->t_start, t_end);
+    if (r->request) {
+        // A streamed reply is recorded with all its frames
+        bool streamed = r->parts.count > 0;
+        if (streamed && reply) {
+            capture_parts_add(&r->parts, reply, reply_len);
+        }
+        capture_record(CAPTURE_DIR_A, r->method, r->request, r->request_len,
+                       streamed ? r->parts.data : reply, streamed ? r->parts.len : reply_len,
+                       status, r->t_start, t_end - r->t_start, streamed);
+    }
+    bridge_conn_slot_complete(r->slot, reply, reply_len);
+
+    if (r->job.dispatch_ns) {
+        sched_done(&r->job);
+    }
+    bridge_request_free(r);
+}
+
+// The client closed its connection while the request was still queued: drop
+// it. One that is already running finishes and its reply is discarded.
+static void bridge_request_orphan(struct conn_slot *slot)
+{
+    struct bridge_request *r = slot->priv;
+
+    if (!sched_cancel(&r->job)) {
+        return;
+    }
+
+    log_debug("Direction A: Client gone, dropping queued request");
+    bridge_conn_slot_complete(r->slot, NULL, 0);
+    bridge_request_free(r);
+}
+
+static void bridge_request_error(struct bridge_request *r, int code, const char *message)
+{
+    bridge_request_finish(r, rpc_format_error(r->id, code, message), -1);
+}
+
 static void handle_rpc_to_ubus_cb(struct ubus_request *ureq, int type, struct blob_attr *msg)
 {
-    (void)ureq; // Suppress warning of unused
     (void)type;
+    struct bridge_request *r = ureq->priv;
     
     if (!msg) {
         log_error("Direction A: No reply from ubus greet.welcome");
@@ -208,107 +458,205 @@ static void handle_rpc_to_ubus_cb(struct ubus_request *ureq, int type, struct bl
     }
 
     log_debug("Direction A: Received ubus callback");
+    if (!r->stream) {
+        if (!r->result_json) {
+            r->result_json = rpc_result_json(msg);
+        }
+        return;
+    }
+
+    // Streaming: every ubus reply message goes out as its own partial frame.
+    // ubusd cannot be paused per request, so a client that stops reading is
+    // cut off once its queue hits RPC_BRIDGE_MAX_STREAM.
+    uloop_timeout_set(&r->timer, BRIDGE_UBUS_TIMEOUT_MS);
+    if (r->stream_failed) {
+        return;
+    }
+
+    char *json = blobmsg_format_json(msg, true);
+    size_t len = 0;
+    char *frame = json ? rpc_format_partial(r->id, json, &len) : NULL;
+
+    if (!frame || bridge_conn_slot_append(r->slot, frame, len) < 0) {
+        log_warn("Direction A: Client not keeping up with streamed reply, dropping the rest");
+        r->stream_failed = true;
+    } else {
+        r->partials++;
+        if (r->request) {
+            capture_parts_add(&r->parts, frame, len);
+        }
+    }
+    free(frame);
+    free(json);
 }
 
-static void handle_bridge_request(int fd)
+static void handle_rpc_to_ubus_complete(struct ubus_request *ureq, int ret)
 {
-    char buf[2048];
-    ssize_t n = read(fd, buf, sizeof(buf) - 1);
-    if (n <= 0) {
-        log_warn("Direction A: Bridge read failed or client closed connection");
-        close(fd);
+    struct bridge_request *r = ureq->priv;
+
+    uloop_timeout_cancel(&r->timer);
+    uint64_t t4 = trace_now_ns();
+    trace_span(r->trace_id, "ubus.invoke", r->t_invoke, t4);
+
+    if (ret != UBUS_STATUS_OK) {
+        log_error("Direction A: ubus_invoke failed with code %d", ret);
+        bridge_request_error(r, 500, "ubus invoke failed");
         return;
     }
 
-    buf[n] = '\0';
-    log_info("Direction A: Bridge received RPC request (%zd bytes)", n);
-    log_debug("Direction A: Request JSON: %s", buf);
+    log_info("Direction A: ubus call succeeded");
 
-    json_object *req = json_tokener_parse(buf);
-    if (!req) {
-        log_error("Direction A: Failed to parse RPC request JSON");
-        close(fd);
+    if (r->stream_failed) {
+        bridge_request_error(r, 503, "client too slow for streamed reply");
         return;
     }
 
-    json_object *id_obj = NULL, *method_obj = NULL, *params_obj = NULL, *name_obj = NULL;
-    int id = 0;
-    const char *method = NULL;
+    // A streamed reply ends with a bare final frame
+    const char *result = r->stream ? "null" : r->result_json ? r->result_json : "{}";
+    char *reply = rpc_format_result(r->id, result);
+    trace_span(r->trace_id, "reply.serialize", t4, trace_now_ns());
+
+    if (!reply) {
+        bridge_request_error(r, 500, "out of memory");
+        return;
+    }
+
+    bridge_request_finish(r, reply, 0);
+    log_info("Direction A: Queued RPC response");
+}
+
+static void handle_rpc_to_ubus_timeout(struct uloop_timeout *t)
+{
+    struct bridge_request *r = container_of(t, struct bridge_request, timer);
+
+    log_error("Direction A: ubus greet.welcome timed out");
+    ubus_abort_request(ubus_ctx, &r->ureq);
+    trace_span(r->trace_id, "ubus.invoke", r->t_invoke, trace_now_ns());
+    bridge_request_error(r, 500, "ubus invoke timed out");
+}
+
+// Scheduler picked this request: look up the object and invoke it asynchronously
+static void bridge_request_run(struct sched_job *job)
+{
+    struct bridge_request *r = container_of(job, struct bridge_request, job);
 
-    json_object_object_get_ex(req, "id", &id_obj);
-    json_object_object_get_ex(req, "method", &method_obj);
-    json_object_object_get_ex(req, "params", &params_obj);
+    trace_span(r->trace_id, "sched.queue", job->enqueue_ns, job->dispatch_ns);
 
-    if (id_obj && json_object_get_type(id_obj) == json_type_int) {
-        id = json_object_get_int(id_obj);
+    uint32_t greet_id;
+    int lookup_ret = ubus_lookup_id(ubus_ctx, GREET_WELCOME_UBUS_OBJECT, &greet_id);
+    r->t_invoke = trace_now_ns();
+    trace_span(r->trace_id, "ubus.lookup", job->dispatch_ns, r->t_invoke);
+
+    if (lookup_ret != UBUS_STATUS_OK) {
+        log_error("Direction A: 'greet' object not found on ubus");
+        bridge_request_error(r, 500, "ubus greet object not found");
+        return;
     }
 
-    if (method_obj && json_object_get_type(method_obj) == json_type_string) {
-        method = json_object_get_string(method_obj);
+    log_debug("Direction A: Found 'greet' object, id=%d", greet_id);
+    log_debug("Direction A: Invoking ubus greet.welcome");
+
+    if (ubus_invoke_async(ubus_ctx, greet_id, GREET_WELCOME_UBUS_METHOD, r->params.head, &r->ureq) != UBUS_STATUS_OK) {
+        log_error("Direction A: ubus_invoke_async failed");
+        bridge_request_error(r, 500, "ubus invoke failed");
+        return;
     }
 
-    if (!params_obj || !json_object_object_get_ex(params_obj, "name", &name_obj)) {
-        log_error("Direction A: Missing 'name' parameter in RPC request");
-        
-        const char *error_reply = "{\"id\":0,\"result\":null,\"error\":{\"code\":400,\"message\":\"Missing name parameter\"}}";
-        write(fd, error_reply, strlen(error_reply));
-        write(fd, "\n", 1);
-        close(fd);
-        json_object_put(req);
+    r->ureq.data_cb = handle_rpc_to_ubus_cb;
+    r->ureq.complete_cb = handle_rpc_to_ubus_complete;
+    r->ureq.priv = r;
+    ubus_complete_request_async(ubus_ctx, &r->ureq);
+
+    r->timer.cb = handle_rpc_to_ubus_timeout;
+    uloop_timeout_set(&r->timer, BRIDGE_UBUS_TIMEOUT_MS);
+}
+
+// One request line from a bridge client; the connection keeps reading while
+// earlier requests on it are still in flight
+static void handle_bridge_request(struct bridge_conn *conn, const char *line, size_t len,
+                                  uint64_t read_ns)
+{
+    struct bridge_request *r = calloc(1, sizeof(*r));
+    if (!r) {
         return;
     }
+    r->t_start = read_ns;
 
-    const char *name = json_object_get_string(name_obj);
-    log_info("Direction A: RPC->ubus forwarding method='%s' name='%s'", method, name);
+    log_info("Direction A: Bridge received RPC request (%zu bytes)", len);
+    log_debug("Direction A: Request JSON: %.*s", (int)len, line);
 
-    uint32_t greet_id;
-    if (ubus_lookup_id(ubus_ctx, "greet", &greet_id) < 0) {
-        log_error("Direction A: 'greet' object not found on ubus");
-        
-        char error_buf[256];
-        snprintf(error_buf, sizeof(error_buf), 
-            "{\"id\":%d,\"result\":null,\"error\":{\"code\":500,\"message\":\"ubus greet object not found\"}}\n", id);
-        write(fd, error_buf, strlen(error_buf));
-        close(fd);
-        json_object_put(req);
+    if (capture_enabled()) {
+        r->request = strndup(line, len);
+        r->request_len = len;
+    }
+
+    uint64_t t1 = trace_now_ns();
+    struct rpc_request req;
+    struct greet_welcome_params params;
+    int ret = rpc_read_request(line, len, &req, &params);
+
+    // Continue the caller's trace if it sent one
+    if (req.present & RPC_REQUEST_HAS_TRACE_ID) {
+        r->trace_id = trace_id_from_str(req.trace_id);
+    }
+    if (!r->trace_id) {
+        r->trace_id = trace_new_id();
+    }
+
+    // Reserve the reply position before anything can complete
+    r->slot = bridge_conn_slot(conn, r->trace_id);
+    if (!r->slot) {
+        // Without a slot no reply can be ordered behind the earlier ones
+        log_error("Direction A: No memory for a reply slot, closing the client connection");
+        bridge_conn_abort(conn);
+        rpc_request_free(&req);
+        greet_welcome_params_free(&params);
+        free(r->request);
+        free(r);
         return;
     }
 
-    log_debug("Direction A: Found 'greet' object, id=%d", greet_id);
+    if (ret == RPC_JSON_INVALID) {
+        log_error("Direction A: Failed to parse RPC request JSON");
+        rpc_request_free(&req);
+        greet_welcome_params_free(&params);
+        bridge_request_error(r, 400, "Invalid JSON");
+        return;
+    }
 
-    struct blob_buf b = {};
-    blob_buf_init(&b, 0);
-    blobmsg_add_string(&b, "name", name);
+    r->id = req.id;     // 0 when absent
+    r->stream = req.stream;
+    r->slot->accept_fd = req.accept_fd;
+    r->slot->orphan = bridge_request_orphan;
+    r->slot->priv = r;
+    if (req.present & RPC_REQUEST_HAS_METHOD) {
+        snprintf(r->method, sizeof(r->method), "%s", req.method);
+    }
 
-    log_debug("Direction A: Invoking ubus greet.welcome");
-    int ubus_ret = ubus_invoke(ubus_ctx, greet_id, "welcome", b.head, 
-                               handle_rpc_to_ubus_cb, NULL, 3000);
-    blob_buf_free(&b);
+    uint64_t t2 = trace_now_ns();
+    trace_span(r->trace_id, "client.read", r->t_start, t1);
+    trace_span(r->trace_id, "json.parse", t1, t2);
 
-    if (ubus_ret < 0) {
-        log_error("Direction A: ubus_invoke failed with code %d", ubus_ret);
-        
-        char error_buf[256];
-        snprintf(error_buf, sizeof(error_buf), 
-            "{\"id\":%d,\"result\":null,\"error\":{\"code\":500,\"message\":\"ubus invoke failed\"}}\n", id);
-        write(fd, error_buf, strlen(error_buf));
-        close(fd);
-        json_object_put(req);
+    if (ret == RPC_JSON_MISSING) {
+        log_error("Direction A: Missing 'name' parameter in RPC request");
+        bridge_request_error(r, 400, "Missing name parameter");
+        rpc_request_free(&req);
+        greet_welcome_params_free(&params);
         return;
     }
 
-    log_info("Direction A: ubus call succeeded");
+    log_info("Direction A: RPC->ubus forwarding method='%s' name='%s'", req.method, params.name);
 
-    char greeting[512];
-    snprintf(greeting, sizeof(greeting), 
-        "{\"id\":%d,\"result\":{\"message\":\"Hello %s, Welcome to XYZ Company\"},\"error\":null}\n", 
-        id, name);
-    
-    write(fd, greeting, strlen(greeting));
-    log_info("Direction A: Sent RPC response");
-    
-    json_object_put(req);
-    close(fd);
+    blob_buf_init(&r->params, 0);
+    greet_welcome_params_to_blob(&r->params, &params);
+
+    // Classified by the ubus call that will run, not by the client's "method"
+    enum sched_class cls = sched_classify(GREET_WELCOME_UBUS_OBJECT "." GREET_WELCOME_UBUS_METHOD,
+                                          false, bridge_conn_peer_uid(conn));
+    rpc_request_free(&req);
+    greet_welcome_params_free(&params);
+
+    sched_submit(&r->job, cls, bridge_request_run);
 }
 
 static void bridge_socket_cb(struct uloop_fd *u, unsigned int events)
@@ -316,22 +664,37 @@ static void bridge_socket_cb(struct uloop_fd *u, unsigned int events)
     (void)u;
     
     if (events & ULOOP_READ) {
-        int client_fd = accept(bridge_listener_fd, NULL, NULL);
+        int client_fd = accept4(bridge_listener_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (client_fd < 0) {
             log_error("Bridge listener: accept() failed");
             return;
         }
-        log_debug("Bridge listener: Client connected (fd=%d)", client_fd);
-        handle_bridge_request(client_fd);
+        bridge_conn_accept(client_fd);
     }
 }
 
 static struct uloop_fd bridge_fd_listener = {.cb = bridge_socket_cb};
 
+// Periodic housekeeping: SIGUSR1 only sets a flag, so check it here to let an
+// idle bridge still dump its trace ring; also push buffered capture records out
+#define HOUSEKEEPING_INTERVAL_MS 1000
+
+static void housekeeping_cb(struct uloop_timeout *t)
+{
+    trace_poll();
+    capture_flush();
+    uloop_timeout_set(t, HOUSEKEEPING_INTERVAL_MS);
+}
+
+static struct uloop_timeout housekeeping_timer = {.cb = housekeeping_cb};
+
 int main(void)
 {
     log_info("Starting ubus-rpc-bridge...");
 
+    trace_init("ubus_rpc_bridge");
+    capture_init();
+
     uloop_init();
     log_debug("Event loop initialized");
 
@@ -356,6 +719,20 @@ int main(void)
     }
     log_info("Registered ubus object 'rpc_greet' with method 'welcome'");
 
+    if (ubus_add_object(ubus_ctx, &bridge_object) < 0)
+    {
+        log_error("Failed to register rpc_bridge object on ubus");
+        ubus_free(ubus_ctx);
+        return 1;
+    }
+    log_info("Registered ubus object 'rpc_bridge' with method 'stats'");
+
+    upstream_config_load();
+    payload_config_load();
+    upstream_pool_init(&rpc_pool, RPC_SOCK_PATH);
+    sched_init();
+    bridge_conn_init(handle_bridge_request);
+
     // Create socket
     bridge_listener_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (bridge_listener_fd < 0) {
@@ -391,6 +768,8 @@ int main(void)
     uloop_fd_add(&bridge_fd_listener, ULOOP_READ);
     log_debug("Bridge socket registered with event loop");
 
+    uloop_timeout_set(&housekeeping_timer, HOUSEKEEPING_INTERVAL_MS);
+
     log_info("ubus-rpc-bridge started successfully (PID=%d)", getpid());
     log_info("Ready to handle:");
     log_info("  - Direction B: ubus calls to rpc_greet.welcome");
@@ -403,6 +782,8 @@ int main(void)
     uloop_done();
     close(bridge_listener_fd);
     unlink(BRIDGE_SOCK_PATH);
+    trace_shutdown();
+    capture_shutdown();
 
     return 0;
 }
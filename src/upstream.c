@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include "log.h"
+#include "rpc_protocol.h"
+#include "trace.h"
+#include "upstream.h"
+
+static struct {
+    unsigned int timeout_ms;
+    unsigned int failure_threshold;
+    unsigned int slow_ms;
+    unsigned int backoff_ms;
+    unsigned int backoff_max_ms;
+} cfg = {
+    .timeout_ms = 2000,
+    .failure_threshold = 5,
+    .slow_ms = 1000,
+    .backoff_ms = 500,
+    .backoff_max_ms = 30000,
+};
+
+static unsigned int env_uint(const char *name, unsigned int def)
+{
+    const char *val = getenv(name);
+    if (!val || !*val)
+        return def;
+
+    unsigned long v = strtoul(val, NULL, 10);
+    return v ? (unsigned int)v : def;
+}
+
+void upstream_config_load(void)
+{
+    cfg.timeout_ms = env_uint("RPC_UPSTREAM_TIMEOUT_MS", cfg.timeout_ms);
+    cfg.failure_threshold = env_uint("RPC_BREAKER_FAILURES", cfg.failure_threshold);
+    cfg.slow_ms = env_uint("RPC_BREAKER_SLOW_MS", cfg.slow_ms);
+    cfg.backoff_ms = env_uint("RPC_BREAKER_BACKOFF_MS", cfg.backoff_ms);
+    cfg.backoff_max_ms = env_uint("RPC_BREAKER_BACKOFF_MAX_MS", cfg.backoff_max_ms);
+
+    log_debug("upstream: timeout=%ums breaker failures=%u slow=%ums backoff=%u..%ums",
+              cfg.timeout_ms, cfg.failure_threshold, cfg.slow_ms,
+              cfg.backoff_ms, cfg.backoff_max_ms);
+}
+
+const char *upstream_state_name(enum upstream_state state)
+{
+    switch (state) {
+    case UPSTREAM_CLOSED:
+        return "closed";
+    case UPSTREAM_OPEN:
+        return "open";
+    case UPSTREAM_HALF_OPEN:
+        return "half-open";
+    }
+    return "unknown";
+}
+
+static void upstream_open(struct upstream *u)
+{
+    if (u->state != UPSTREAM_OPEN) {
+        u->opens++;
+        log_warn("upstream %s: circuit open after %u failures / %u slow calls, probing in %ums",
+                 u->path, u->consecutive_failures, u->consecutive_slow, u->backoff_ms);
+    }
+
+    u->state = UPSTREAM_OPEN;
+    uloop_timeout_set(&u->probe_timer, u->backoff_ms);
+}
+
+static void upstream_close(struct upstream *u)
+{
+    if (u->state != UPSTREAM_CLOSED)
+        log_info("upstream %s: circuit closed", u->path);
+
+    u->state = UPSTREAM_CLOSED;
+    u->consecutive_failures = 0;
+    u->consecutive_slow = 0;
+    u->backoff_ms = cfg.backoff_ms;
+    uloop_timeout_cancel(&u->probe_timer);
+}
+
+static int upstream_call_begin(struct upstream_call *call, struct upstream *u,
+                               char *request, size_t len, uint64_t trace_id,
+                               upstream_call_cb cb, bool probe);
+
+static void upstream_probe_result(struct upstream *u, int ret, uint64_t latency)
+{
+    if (ret == UPSTREAM_OK && latency < (uint64_t)cfg.slow_ms * 1000000ull) {
+        upstream_close(u);
+        return;
+    }
+
+    u->backoff_ms = u->backoff_ms * 2 > cfg.backoff_max_ms ? cfg.backoff_max_ms : u->backoff_ms * 2;
+    log_debug("upstream %s: probe failed (%d), next probe in %ums", u->path, ret, u->backoff_ms);
+    upstream_open(u);
+}
+
+// Liveness check: any reply line to rpc.ping counts as healthy
+static void upstream_probe_done(struct upstream_call *call, int result)
+{
+    struct upstream *u = call->u;
+    uint64_t latency = trace_now_ns() - call->start_ns;
+
+    upstream_call_free(call);
+    free(call);
+    u->probe_call = NULL;
+    upstream_probe_result(u, result, latency);
+}
+
+static void upstream_probe_cb(struct uloop_timeout *t)
+{
+    struct upstream *u = container_of(t, struct upstream, probe_timer);
+    static const char ping[] = "{\"id\":0,\"method\":\"" RPC_PING_METHOD "\",\"params\":{}}\n";
+
+    u->state = UPSTREAM_HALF_OPEN;
+    u->probes++;
+
+    // Runs on the event loop like any call; its own timer bounds it
+    struct upstream_call *call = calloc(1, sizeof(*call));
+    char *request = call ? strdup(ping) : NULL;
+    if (!request) {
+        free(call);
+        upstream_probe_result(u, UPSTREAM_ERROR, 0);
+        return;
+    }
+
+    int ret = upstream_call_begin(call, u, request, sizeof(ping) - 1, trace_new_id(),
+                                  upstream_probe_done, true);
+    if (ret != UPSTREAM_OK) {
+        free(call);
+        upstream_probe_result(u, ret, 0);
+        return;
+    }
+    u->probe_call = call;
+}
+
+void upstream_init(struct upstream *u, const char *path)
+{
+    memset(u, 0, sizeof(*u));
+    u->path = path;
+    u->state = UPSTREAM_CLOSED;
+    u->backoff_ms = cfg.backoff_ms;
+    u->probe_timer.cb = upstream_probe_cb;
+}
+
+bool upstream_allow(struct upstream *u)
+{
+    if (u->state == UPSTREAM_CLOSED)
+        return true;
+
+    u->rejected++;
+    return false;
+}
+
+void upstream_record(struct upstream *u, int result, uint64_t latency_ns)
+{
+    u->calls++;
+
+    if (result != UPSTREAM_OK) {
+        u->failures++;
+        if (result == UPSTREAM_TIMEOUT)
+            u->timeouts++;
+        u->consecutive_failures++;
+    } else {
+        u->consecutive_failures = 0;
+
+        // EWMA with alpha = 1/8
+        u->latency_ewma_ns = u->latency_ewma_ns
+            ? u->latency_ewma_ns - (u->latency_ewma_ns >> 3) + (latency_ns >> 3)
+            : latency_ns;
+
+        if (latency_ns >= (uint64_t)cfg.slow_ms * 1000000ull) {
+            u->slow++;
+            u->consecutive_slow++;
+        } else {
+            u->consecutive_slow = 0;
+        }
+    }
+
+    if (u->state == UPSTREAM_CLOSED &&
+        (u->consecutive_failures >= cfg.failure_threshold ||
+         u->consecutive_slow >= cfg.failure_threshold)) {
+        upstream_open(u);
+    }
+}
+
+void upstream_stats(struct blob_buf *b, const struct upstream *u)
+{
+    void *tbl = blobmsg_open_table(b, NULL);
+
+    blobmsg_add_string(b, "path", u->path);
+    blobmsg_add_string(b, "state", upstream_state_name(u->state));
+    blobmsg_add_u32(b, "consecutive_failures", u->consecutive_failures);
+    blobmsg_add_u32(b, "consecutive_slow", u->consecutive_slow);
+    blobmsg_add_u64(b, "latency_ewma_us", u->latency_ewma_ns / 1000);
+    blobmsg_add_u32(b, "backoff_ms", u->backoff_ms);
+    blobmsg_add_u32(b, "outstanding", u->outstanding);
+    blobmsg_add_u64(b, "calls", u->calls);
+    blobmsg_add_u64(b, "failures", u->failures);
+    blobmsg_add_u64(b, "timeouts", u->timeouts);
+    blobmsg_add_u64(b, "slow", u->slow);
+    blobmsg_add_u64(b, "rejected", u->rejected);
+    blobmsg_add_u64(b, "opens", u->opens);
+    blobmsg_add_u64(b, "probes", u->probes);
+
+    blobmsg_close_table(b, tbl);
+}
+
+// ============== ASYNC UPSTREAM CALL ==============
+#define UPSTREAM_REPLY_CHUNK 2048
+
+static void upstream_call_release_fd(struct upstream_call *call)
+{
+    uloop_timeout_cancel(&call->timer);
+    if (call->fd.fd >= 0) {
+        uloop_fd_delete(&call->fd);
+        close(call->fd.fd);
+        call->fd.fd = -1;
+        call->u->outstanding--;
+    }
+    if (call->out_fd >= 0) {
+        close(call->out_fd);
+        call->out_fd = -1;
+    }
+    payload_fds_close(&call->fds);
+    free(call->out);
+    call->out = NULL;
+}
+
+static void upstream_call_finish(struct upstream_call *call, int result)
+{
+    uint64_t now = trace_now_ns();
+
+    upstream_call_release_fd(call);
+    if (call->sent_ns)
+        trace_span(call->trace_id, "rpc.wait", call->sent_ns, now);
+    if (!call->probe)
+        upstream_record(call->u, result, (call->first_line_ns ? call->first_line_ns : now) - call->start_ns);
+
+    call->cb(call, result);
+}
+
+static void upstream_call_timeout_cb(struct uloop_timeout *t)
+{
+    struct upstream_call *call = container_of(t, struct upstream_call, timer);
+
+    log_error("upstream %s: no response within %ums", call->u->path, cfg.timeout_ms);
+    upstream_call_finish(call, UPSTREAM_TIMEOUT);
+}
+
+static int upstream_call_flush(struct upstream_call *call)
+{
+    while (call->out_off < call->out_len) {
+        ssize_t n = payload_sendmsg(call->fd.fd, call->out + call->out_off,
+                                    call->out_len - call->out_off, call->out_fd, MSG_DONTWAIT);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        // The memfd went out with the first byte; the server holds its own reference
+        if (call->out_fd >= 0) {
+            close(call->out_fd);
+            call->out_fd = -1;
+        }
+        call->out_off += n;
+    }
+
+    call->sent_ns = trace_now_ns();
+    trace_span(call->trace_id, "rpc.send", call->start_ns, call->sent_ns);
+    return 0;
+}
+
+static void upstream_call_fd_cb(struct uloop_fd *ufd, unsigned int events)
+{
+    struct upstream_call *call = container_of(ufd, struct upstream_call, fd);
+
+    if (call->out_off < call->out_len) {
+        if (upstream_call_flush(call) < 0) {
+            upstream_call_finish(call, UPSTREAM_ERROR);
+            return;
+        }
+        if (call->out_off < call->out_len)
+            return;
+        uloop_fd_add(&call->fd, ULOOP_READ);
+    }
+
+    if (!(events & ULOOP_READ))
+        return;
+
+    while (1) {
+        if (call->in_cap - call->in_len < UPSTREAM_REPLY_CHUNK) {
+            size_t cap = call->in_cap ? call->in_cap * 2 : UPSTREAM_REPLY_CHUNK * 2;
+            char *grown = realloc(call->in, cap);
+            if (!grown) {
+                upstream_call_finish(call, UPSTREAM_ERROR);
+                return;
+            }
+            call->in = grown;
+            call->in_cap = cap;
+        }
+
+        ssize_t n = payload_recv(call->fd.fd, call->in + call->in_len,
+                                 call->in_cap - call->in_len, &call->fds);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                upstream_call_finish(call, UPSTREAM_ERROR);
+            return;
+        }
+
+        if (n == 0) {
+            call->reply = call->in;
+            call->reply_len = call->in_len;
+            upstream_call_finish(call, call->in_len ? UPSTREAM_OK : UPSTREAM_ERROR);
+            return;
+        }
+
+        char *nl = memchr(call->in + call->in_len, '\n', n);
+        call->in_len += n;
+        while (nl) {
+            size_t len = nl - call->in;
+            const char *line = call->in;
+            size_t line_len = len;
+
+            // A large line arrives as an envelope plus memfd: read it in place
+            size_t size;
+            if (payload_is_envelope(line, len, &size)) {
+                if (payload_map_next(&call->fds, size, &call->map) < 0) {
+                    upstream_call_finish(call, UPSTREAM_ERROR);
+                    return;
+                }
+                line = call->map.data;
+                line_len = call->map.len;
+            }
+
+            if (!call->line_cb || call->line_cb(call, line, line_len)) {
+                call->reply = line;
+                call->reply_len = line_len;
+                upstream_call_finish(call, UPSTREAM_OK);
+                return;
+            }
+
+            // Partial frame consumed; keep whatever follows it
+            payload_unmap(&call->map);
+            if (!call->first_line_ns)
+                call->first_line_ns = trace_now_ns();
+            call->in_len -= len + 1;
+            memmove(call->in, nl + 1, call->in_len);
+            uloop_timeout_set(&call->timer, cfg.timeout_ms);
+            nl = memchr(call->in, '\n', call->in_len);
+        }
+    }
+}
+
+static int upstream_call_begin(struct upstream_call *call, struct upstream *u,
+                               char *request, size_t len, uint64_t trace_id,
+                               upstream_call_cb cb, bool probe)
+{
+    memset(call, 0, sizeof(*call));
+    call->u = u;
+    call->cb = cb;
+    call->probe = probe;
+    call->trace_id = trace_id;
+    call->out = request;
+    call->out_len = len;
+    call->out_fd = -1;
+    call->fd.fd = -1;
+    call->fd.cb = upstream_call_fd_cb;
+    call->timer.cb = upstream_call_timeout_cb;
+    call->start_ns = trace_now_ns();
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        free(request);
+        call->out = NULL;
+        return UPSTREAM_ERROR;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, u->path, sizeof(addr.sun_path) - 1);
+
+    // AF_UNIX connect completes immediately or fails (EAGAIN = backlog full)
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        log_error("upstream %s: connect() failed: %s", u->path, strerror(errno));
+        close(fd);
+        free(request);
+        call->out = NULL;
+        if (!probe)
+            upstream_record(u, UPSTREAM_ERROR, trace_now_ns() - call->start_ns);
+        return UPSTREAM_ERROR;
+    }
+    call->fd.fd = fd;
+    u->outstanding++;
+    trace_span(trace_id, "rpc.connect", call->start_ns, trace_now_ns());
+
+    // Large request: one copy into a sealed memfd, the socket only carries the envelope
+    if (len > payload_inline_max()) {
+        int mfd = payload_memfd(request, len);
+        char *env = mfd >= 0 ? malloc(PAYLOAD_ENVELOPE_MAX) : NULL;
+        if (env) {
+            call->out_len = payload_envelope(env, PAYLOAD_ENVELOPE_MAX, len);
+            call->out = env;
+            call->out_fd = mfd;
+            free(request);
+        } else if (mfd >= 0) {
+            close(mfd);     // fall back to sending it inline
+        }
+    }
+
+    if (upstream_call_flush(call) < 0) {
+        upstream_call_release_fd(call);
+        if (!probe)
+            upstream_record(u, UPSTREAM_ERROR, trace_now_ns() - call->start_ns);
+        return UPSTREAM_ERROR;
+    }
+
+    uloop_fd_add(&call->fd, call->out_off < call->out_len ? ULOOP_WRITE : ULOOP_READ);
+    uloop_timeout_set(&call->timer, cfg.timeout_ms);
+    return UPSTREAM_OK;
+}
+
+int upstream_call_start(struct upstream_call *call, struct upstream *u,
+                        char *request, size_t len, uint64_t trace_id,
+                        upstream_call_cb cb)
+{
+    if (!upstream_allow(u)) {
+        memset(call, 0, sizeof(*call));
+        call->fd.fd = -1;
+        call->out_fd = -1;
+        free(request);
+        return UPSTREAM_REJECTED;
+    }
+
+    return upstream_call_begin(call, u, request, len, trace_id, cb, false);
+}
+
+void upstream_call_cancel(struct upstream_call *call)
+{
+    upstream_call_release_fd(call);
+}
+
+void upstream_call_free(struct upstream_call *call)
+{
+    payload_unmap(&call->map);
+    free(call->in);
+    call->in = NULL;
+    call->in_len = call->in_cap = 0;
+    call->reply = NULL;
+    call->reply_len = 0;
+}
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "log.h"
+#include "trace.h"
+#include "upstream_pool.h"
+
+#define POOL_HEDGE_MIN_SAMPLES  20      // no hedging until the p95 means something
+#define POOL_P95_REFRESH        16      // recompute the p95 every N samples
+
+static unsigned int env_uint(const char *name, unsigned int def)
+{
+    const char *val = getenv(name);
+    if (!val || !*val)
+        return def;
+
+    unsigned long v = strtoul(val, NULL, 10);
+    return v ? (unsigned int)v : def;
+}
+
+// FNV-1a with a murmur3 finalizer; plain FNV clusters on short similar keys
+static uint32_t pool_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int ring_cmp(const void *a, const void *b)
+{
+    uint32_t pa = *(const uint32_t *)a, pb = *(const uint32_t *)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static void pool_build_ring(struct upstream_pool *pool)
+{
+    char vnode[128];
+
+    pool->ring_len = 0;
+    for (unsigned int i = 0; i < pool->n; i++) {
+        for (unsigned int v = 0; v < UPSTREAM_POOL_VNODES; v++) {
+            snprintf(vnode, sizeof(vnode), "%s#%u", pool->paths[i], v);
+            pool->ring[pool->ring_len].point = pool_hash(vnode);
+            pool->ring[pool->ring_len].idx = i;
+            pool->ring_len++;
+        }
+    }
+
+    qsort(pool->ring, pool->ring_len, sizeof(pool->ring[0]), ring_cmp);
+}
+
+void upstream_pool_init(struct upstream_pool *pool, const char *default_path)
+{
+    const char *list = getenv("RPC_UPSTREAMS");
+    const char *balance = getenv("RPC_BALANCE");
+    const char *param = getenv("RPC_BALANCE_HASH_PARAM");
+
+    memset(pool, 0, sizeof(*pool));
+
+    if (!list || !*list)
+        list = default_path;
+
+    while (*list && pool->n < UPSTREAM_POOL_MAX) {
+        const char *sep = strchr(list, ',');
+        size_t len = sep ? (size_t)(sep - list) : strlen(list);
+
+        if (len && len < sizeof(pool->paths[0])) {
+            memcpy(pool->paths[pool->n], list, len);
+            pool->paths[pool->n][len] = '\0';
+            upstream_init(&pool->upstreams[pool->n], pool->paths[pool->n]);
+            pool->n++;
+        } else if (len) {
+            log_warn("upstream pool: socket path too long, ignored: %.*s", (int)len, list);
+        }
+
+        if (!sep)
+            break;
+        list = sep + 1;
+    }
+
+    if (!pool->n) {
+        snprintf(pool->paths[0], sizeof(pool->paths[0]), "%s", default_path);
+        upstream_init(&pool->upstreams[0], pool->paths[0]);
+        pool->n = 1;
+    }
+
+    pool->policy = balance && strcmp(balance, "hash") == 0 ? UPSTREAM_POLICY_HASH : UPSTREAM_POLICY_LEAST;
+    snprintf(pool->hash_param, sizeof(pool->hash_param), "%s", param && *param ? param : "name");
+    pool_build_ring(pool);
+
+    pool->hedge = env_uint("RPC_HEDGE", 0) != 0;
+    pool->hedge_min_ms = env_uint("RPC_HEDGE_MIN_MS", 5);
+
+    for (unsigned int i = 0; i < pool->n; i++)
+        log_info("upstream pool: instance %u at %s", i, pool->paths[i]);
+    log_debug("upstream pool: policy=%s hash_param=%s hedge=%s min=%ums",
+              pool->policy == UPSTREAM_POLICY_HASH ? "hash" : "least",
+              pool->hash_param, pool->hedge ? "on" : "off", pool->hedge_min_ms);
+}
+
+const char *upstream_pool_hash_param(const struct upstream_pool *pool)
+{
+    return pool->policy == UPSTREAM_POLICY_HASH ? pool->hash_param : NULL;
+}
+
+static bool pool_usable(const struct upstream *u, const struct upstream *exclude, bool healthy_only)
+{
+    return u != exclude && (!healthy_only || u->state == UPSTREAM_CLOSED);
+}
+
+static struct upstream *pool_pick_least(struct upstream_pool *pool, const struct upstream *exclude,
+                                        bool healthy_only)
+{
+    struct upstream *best = NULL;
+
+    for (unsigned int i = 0; i < pool->n; i++) {
+        struct upstream *u = &pool->upstreams[i];
+
+        if (!pool_usable(u, exclude, healthy_only))
+            continue;
+        if (!best || u->outstanding < best->outstanding ||
+            (u->outstanding == best->outstanding && u->latency_ewma_ns < best->latency_ewma_ns))
+            best = u;
+    }
+
+    return best;
+}
+
+// Walk the ring clockwise from the key's point to the first usable instance
+static struct upstream *pool_pick_hash(struct upstream_pool *pool, uint32_t key_hash,
+                                       const struct upstream *exclude, bool healthy_only)
+{
+    unsigned int lo = 0, hi = pool->ring_len;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (pool->ring[mid].point < key_hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (unsigned int i = 0; i < pool->ring_len; i++) {
+        struct upstream *u = &pool->upstreams[pool->ring[(lo + i) % pool->ring_len].idx];
+        if (pool_usable(u, exclude, healthy_only))
+            return u;
+    }
+
+    return NULL;
+}
+
+static struct upstream *pool_pick(struct pool_call *pc, const struct upstream *exclude, bool healthy_only)
+{
+    struct upstream_pool *pool = pc->pool;
+
+    if (pool->policy == UPSTREAM_POLICY_HASH && pc->key_hash)
+        return pool_pick_hash(pool, pc->key_hash, exclude, healthy_only);
+    return pool_pick_least(pool, exclude, healthy_only);
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+    uint64_t va = *(const uint64_t *)a, vb = *(const uint64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+static void pool_record_latency(struct upstream_pool *pool, uint64_t latency_ns)
+{
+    pool->latency[pool->latency_pos] = latency_ns;
+    pool->latency_pos = (pool->latency_pos + 1) % UPSTREAM_POOL_LAT_RING;
+    if (pool->latency_count < UPSTREAM_POOL_LAT_RING)
+        pool->latency_count++;
+
+    // First p95 as soon as hedging may start, then every POOL_P95_REFRESH samples
+    if (pool->latency_count < POOL_HEDGE_MIN_SAMPLES ||
+        (pool->latency_count != POOL_HEDGE_MIN_SAMPLES && pool->latency_pos % POOL_P95_REFRESH))
+        return;
+
+    uint64_t sorted[UPSTREAM_POOL_LAT_RING];
+    memcpy(sorted, pool->latency, pool->latency_count * sizeof(sorted[0]));
+    qsort(sorted, pool->latency_count, sizeof(sorted[0]), u64_cmp);
+    pool->p95_ns = sorted[pool->latency_count * 95 / 100];
+}
+
+static unsigned int pool_hedge_delay_ms(const struct upstream_pool *pool)
+{
+    unsigned int ms = (unsigned int)((pool->p95_ns + 999999) / 1000000);
+    return ms > pool->hedge_min_ms ? ms : pool->hedge_min_ms;
+}
+
+static void pool_cancel_other(struct pool_call *pc, unsigned int idx)
+{
+    uloop_timeout_cancel(&pc->hedge_timer);
+    if (pc->active > 1) {
+        // A primary that lost still took at least this long
+        if (idx == 1)
+            pool_record_latency(pc->pool, trace_now_ns() - pc->calls[0].start_ns);
+        upstream_call_cancel(&pc->calls[!idx]);
+        pc->active--;
+        pc->pool->cancelled++;
+        trace_span(pc->trace_id, "rpc.cancel", pc->calls[!idx].start_ns, trace_now_ns());
+    }
+    free(pc->request);
+    pc->request = NULL;
+}
+
+static void pool_hedge_cb(struct upstream_call *call, int result);
+static int pool_hedge_line(struct upstream_call *call, const char *line, size_t len);
+
+// Send the kept request copy to another instance as calls[1]; true if it is in flight
+static bool pool_start_second(struct pool_call *pc, const struct upstream *exclude)
+{
+    struct upstream *u = pool_pick(pc, exclude, true);
+
+    if (!u || !pc->request)
+        return false;
+
+    char *request = pc->request;
+    pc->request = NULL;     // owned by the second call now
+
+    if (upstream_call_start(&pc->calls[1], u, request, pc->request_len, pc->trace_id,
+                            pool_hedge_cb) != UPSTREAM_OK)
+        return false;
+
+    pc->active++;
+    if (pc->line_cb)
+        pc->calls[1].line_cb = pool_hedge_line;
+    return true;
+}
+
+static void pool_call_done(struct pool_call *pc, unsigned int idx, int result)
+{
+    struct upstream_pool *pool = pc->pool;
+    struct upstream_call *call = &pc->calls[idx];
+
+    // Hedge latencies are not sampled: they only exist when the primary was slow
+    if (result == UPSTREAM_OK && idx == 0) {
+        uint64_t end = call->first_line_ns ? call->first_line_ns : trace_now_ns();
+        pool_record_latency(pool, end - call->start_ns);
+    }
+
+    // The other instance may still answer
+    if (result != UPSTREAM_OK && pc->active > 1) {
+        pc->active--;
+        upstream_call_free(call);
+        return;
+    }
+
+    // A primary that failed without timing out is retried once on another
+    // instance, unless part of its reply was already forwarded
+    if (result != UPSTREAM_OK && result != UPSTREAM_TIMEOUT && idx == 0 && !pc->committed) {
+        uloop_timeout_cancel(&pc->hedge_timer);
+        pc->active--;
+        upstream_call_free(call);
+        if (pool_start_second(pc, call->u)) {
+            pc->retried = true;
+            pool->retries++;
+            log_debug("upstream pool: %s failed (%d), retrying on %s",
+                      call->u->path, result, pc->calls[1].u->path);
+            return;
+        }
+        pc->active++;
+    }
+
+    pool_cancel_other(pc, idx);
+    pc->active--;
+    if (idx == 1 && result == UPSTREAM_OK && !pc->retried)
+        pool->hedge_wins++;
+
+    pc->reply = call->reply;
+    pc->reply_len = call->reply_len;
+    pc->winner = call->u;
+
+    pc->cb(pc, result);     // may free 'pc'
+}
+
+static void pool_primary_cb(struct upstream_call *call, int result)
+{
+    pool_call_done(container_of(call, struct pool_call, calls[0]), 0, result);
+}
+
+static void pool_hedge_cb(struct upstream_call *call, int result)
+{
+    pool_call_done(container_of(call, struct pool_call, calls[1]), 1, result);
+}
+
+static int pool_line(struct pool_call *pc, unsigned int idx, const char *line, size_t len)
+{
+    int final = pc->line_cb(pc, line, len);
+
+    // Partial frames from two instances cannot be merged: stick with this one
+    if (!final && !pc->committed) {
+        pc->committed = true;
+        pool_cancel_other(pc, idx);
+    }
+    return final;
+}
+
+static int pool_primary_line(struct upstream_call *call, const char *line, size_t len)
+{
+    return pool_line(container_of(call, struct pool_call, calls[0]), 0, line, len);
+}
+
+static int pool_hedge_line(struct upstream_call *call, const char *line, size_t len)
+{
+    return pool_line(container_of(call, struct pool_call, calls[1]), 1, line, len);
+}
+
+static void pool_hedge_timer_cb(struct uloop_timeout *t)
+{
+    struct pool_call *pc = container_of(t, struct pool_call, hedge_timer);
+
+    log_debug("upstream pool: no reply from %s after %ums, hedging",
+              pc->calls[0].u->path, pool_hedge_delay_ms(pc->pool));
+    trace_span(pc->trace_id, "rpc.hedge", pc->calls[0].start_ns, trace_now_ns());
+
+    if (pool_start_second(pc, pc->calls[0].u))
+        pc->pool->hedges++;
+}
+
+int pool_call_start(struct pool_call *pc, struct upstream_pool *pool, const char *key,
+                    char *request, size_t len, uint64_t trace_id, pool_call_cb cb)
+{
+    memset(pc, 0, sizeof(*pc));
+    pc->pool = pool;
+    pc->cb = cb;
+    pc->trace_id = trace_id;
+    pc->key_hash = key ? pool_hash(key) : 0;
+    pc->hedge_timer.cb = pool_hedge_timer_cb;
+    pc->calls[1].fd.fd = -1;
+    pc->calls[1].out_fd = -1;
+
+    // Prefer a closed circuit; if all are open, let the breaker reject the call
+    struct upstream *u = pool_pick(pc, NULL, true);
+    if (!u)
+        u = pool_pick(pc, NULL, false);
+
+    // With more than one instance a copy is kept for a retry or a hedge
+    if (pool->n > 1) {
+        pc->request = malloc(len);
+        if (pc->request) {
+            memcpy(pc->request, request, len);
+            pc->request_len = len;
+        }
+    }
+
+    int ret = upstream_call_start(&pc->calls[0], u, request, len, trace_id, pool_primary_cb);
+    if (ret != UPSTREAM_OK) {
+        // Rejected or unreachable right away: try one other instance
+        if (pool_start_second(pc, u)) {
+            pc->retried = true;
+            pool->retries++;
+            log_debug("upstream pool: %s failed (%d), retrying on %s",
+                      u->path, ret, pc->calls[1].u->path);
+            return UPSTREAM_OK;
+        }
+        free(pc->request);
+        pc->request = NULL;
+        return ret;
+    }
+
+    pc->active = 1;
+    bool hedge = pool->hedge && pool->latency_count >= POOL_HEDGE_MIN_SAMPLES && pool->p95_ns;
+    if (pc->request && hedge)
+        uloop_timeout_set(&pc->hedge_timer, pool_hedge_delay_ms(pool));
+    return UPSTREAM_OK;
+}
+
+void pool_call_stream(struct pool_call *pc, pool_line_cb line_cb)
+{
+    pc->line_cb = line_cb;
+    pc->calls[0].line_cb = pool_primary_line;
+    pc->calls[1].line_cb = pool_hedge_line;    // the start may have retried on calls[1]
+}
+
+void pool_call_free(struct pool_call *pc)
+{
+    upstream_call_free(&pc->calls[0]);
+    upstream_call_free(&pc->calls[1]);
+    pc->reply = NULL;
+    pc->reply_len = 0;
+}
+
+void upstream_pool_stats(struct blob_buf *b, const struct upstream_pool *pool)
+{
+    void *arr = blobmsg_open_array(b, "upstreams");
+    for (unsigned int i = 0; i < pool->n; i++)
+        upstream_stats(b, &pool->upstreams[i]);
+    blobmsg_close_array(b, arr);
+
+    void *tbl = blobmsg_open_table(b, "balancer");
+    blobmsg_add_string(b, "policy", pool->policy == UPSTREAM_POLICY_HASH ? "hash" : "least");
+    if (pool->policy == UPSTREAM_POLICY_HASH)
+        blobmsg_add_string(b, "hash_param", pool->hash_param);
+    blobmsg_add_u8(b, "hedge", pool->hedge);
+    blobmsg_add_u64(b, "p95_us", pool->p95_ns / 1000);
+    blobmsg_add_u64(b, "hedges", pool->hedges);
+    blobmsg_add_u64(b, "hedge_wins", pool->hedge_wins);
+    blobmsg_add_u64(b, "cancelled", pool->cancelled);
+    blobmsg_add_u64(b, "retries", pool->retries);
+    blobmsg_close_table(b, tbl);
+}
@@ -0,0 +1,30 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// ============== UNIT TEST HELPERS ==============
+// Every tests/test_*.c is a program of its own, run by "make test". CHECK()
+// reports a failed condition and carries on; test_summary() prints the count
+// and gives main() its exit status.
+
+static int test_checks;
+static int test_failures;
+
+#define CHECK(cond, ...) do {                                           \
+        test_checks++;                                                  \
+        if (!(cond)) {                                                  \
+            test_failures++;                                            \
+            fprintf(stderr, "%s:%d: check failed: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fputc('\n', stderr);                                        \
+        }                                                               \
+    } while (0)
+
+static inline int test_summary(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,158 @@
+// What the bridge records must read back unchanged, in order, for
+// bridge_replay: both directions, streamed replies, records without a reply.
+// A record too large for the header is left out rather than desyncing the
+// file, and a file cut short is an error, not a clean end.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "trace.h"
+#include "test.h"
+
+#define BIG_PAYLOAD (300 * 1024)    // more than the capture's stdio buffer
+
+struct expect {
+    enum capture_dir dir;
+    const char *method;
+    const char *payload;
+    size_t payload_len;
+    const char *reply;
+    size_t reply_len;
+    int status;
+    uint64_t arrival_ns;            // relative to capture_init()
+    uint64_t latency_ns;
+    bool streamed;
+};
+
+static void check_record(FILE *fp, const struct expect *e, int i)
+{
+    struct capture_record rec;
+
+    CHECK(capture_read(fp, &rec) == 1, "record %d: read", i);
+    CHECK(rec.hdr.direction == e->dir && rec.hdr.status == e->status &&
+          rec.hdr.latency_ns == e->latency_ns, "record %d: header", i);
+    CHECK(!!(rec.hdr.flags & CAPTURE_F_STREAMED) == e->streamed, "record %d: flags %x", i, rec.hdr.flags);
+    // Arrival is taken again inside capture_init(), after the test's own clock read
+    CHECK(rec.hdr.arrival_ns <= e->arrival_ns && rec.hdr.arrival_ns + 1000000000ull > e->arrival_ns,
+          "record %d: arrival %llu, expected about %llu", i,
+          (unsigned long long)rec.hdr.arrival_ns, (unsigned long long)e->arrival_ns);
+    CHECK(rec.method && strcmp(rec.method, e->method) == 0, "record %d: method", i);
+    CHECK(rec.hdr.payload_len == e->payload_len && rec.payload &&
+          memcmp(rec.payload, e->payload, e->payload_len) == 0, "record %d: payload", i);
+    CHECK(rec.hdr.reply_len == e->reply_len && rec.reply &&
+          (!e->reply_len || memcmp(rec.reply, e->reply, e->reply_len) == 0), "record %d: reply", i);
+    capture_record_free(&rec);
+}
+
+int main(void)
+{
+    char path[64], cut_path[80];
+    static char big[BIG_PAYLOAD];
+    struct capture_parts parts = {0};
+    const char binary[] = "bin\0ary\n\0";
+
+    snprintf(path, sizeof(path), "/tmp/test_capture.%d", (int)getpid());
+    snprintf(cut_path, sizeof(cut_path), "%s.cut", path);
+    setenv(CAPTURE_ENV_FILE, path, 1);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t before_realtime = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    uint64_t t0 = trace_now_ns();
+
+    CHECK(capture_init() == 0 && capture_enabled(), "capture_init");
+
+    // Three parts of a Direction A stream, the last one already ending in '\n'
+    capture_parts_add(&parts, "{\"partial\":1}", 13);
+    capture_parts_add(&parts, "{\"partial\":2}", 13);
+    capture_parts_add(&parts, "{\"result\":3}\n", 13);
+    CHECK(parts.count == 3 && parts.len == 41 &&
+          strcmp(parts.data, "{\"partial\":1}\n{\"partial\":2}\n{\"result\":3}\n") == 0,
+          "parts: %u, '%s'", parts.count, parts.data ? parts.data : "");
+
+    memset(big, 'p', sizeof(big));
+    const struct expect records[] = {
+        {CAPTURE_DIR_A, "greet.welcome", "{\"name\":\"a\"}\n", 13, "{\"result\":\"hi a\"}\n", 18,
+         0, 1000, 250000, false},
+        {CAPTURE_DIR_B, "greet.welcome", "{\"name\":\"b\"}", 12, NULL, 0,
+         4, 2000000, 7, false},
+        {CAPTURE_DIR_A, "stream.count", "{\"n\":3}\n", 8, parts.data, parts.len,
+         0, 3000000, 900000000, true},
+        {CAPTURE_DIR_B, "", binary, sizeof(binary), binary, sizeof(binary),
+         -1, 4000000, 1, false},
+        {CAPTURE_DIR_A, "greet.big", big, sizeof(big), "{}\n", 3,
+         0, 5000000, 2, false},
+    };
+    const int n_records = (int)(sizeof(records) / sizeof(records[0]));
+
+    for (int i = 0; i < n_records; i++) {
+        const struct expect *e = &records[i];
+        capture_record(e->dir, e->method, e->payload, e->payload_len, e->reply, e->reply_len,
+                       e->status, t0 + e->arrival_ns, e->latency_ns, e->streamed);
+
+        // Lengths the header cannot hold: skipped, the next record still lines up
+        if (i == 1)
+            capture_record(CAPTURE_DIR_A, "too.large", "x", (size_t)UINT32_MAX + 1, "y", 1,
+                           0, t0, 0, false);
+    }
+    capture_parts_free(&parts);
+    capture_shutdown();
+    CHECK(!capture_enabled(), "capture_shutdown");
+
+    // Once shut down, nothing more is written
+    capture_record(CAPTURE_DIR_A, "late", "{}", 2, NULL, 0, 0, t0, 0, false);
+
+    // Read back the same records, then a clean end of file
+    uint64_t start_realtime = 0;
+    FILE *fp = capture_open(path, &start_realtime);
+    CHECK(fp != NULL, "capture_open");
+    if (fp) {
+        CHECK(start_realtime >= before_realtime &&
+              start_realtime < before_realtime + 60 * 1000000000ull, "start_realtime");
+        struct capture_record rec;
+        for (int i = 0; i < n_records; i++)
+            check_record(fp, &records[i], i);
+        CHECK(capture_read(fp, &rec) == 0, "end of file");
+        fclose(fp);
+    }
+
+    // The same file cut inside its last record
+    FILE *in = fopen(path, "rb");
+    FILE *out = fopen(cut_path, "wb");
+    CHECK(in && out, "copy for truncation");
+    if (in && out) {
+        fseek(in, 0, SEEK_END);
+        long size = ftell(in) - 5;
+        rewind(in);
+        for (long i = 0; i < size; i++)
+            fputc(fgetc(in), out);
+    }
+    if (in)
+        fclose(in);
+    if (out)
+        fclose(out);
+
+    fp = capture_open(cut_path, NULL);
+    CHECK(fp != NULL, "capture_open on the cut file");
+    if (fp) {
+        struct capture_record rec;
+        for (int i = 0; i < n_records - 1; i++)
+            check_record(fp, &records[i], i);
+        CHECK(capture_read(fp, &rec) == -1, "truncated record not reported");
+        fclose(fp);
+    }
+
+    // Not a capture file at all
+    out = fopen(cut_path, "wb");
+    if (out) {
+        fputs("{\"not\":\"a capture\"}\n", out);
+        fclose(out);
+    }
+    CHECK(capture_open(cut_path, NULL) == NULL, "foreign file accepted");
+
+    unlink(path);
+    unlink(cut_path);
+    return test_summary("test_capture");
+}
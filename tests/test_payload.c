@@ -0,0 +1,89 @@
+// payload_map_next() must only map what a receiver can parse safely: a
+// memfd sealed against writes and shrinking, of exactly the envelope's size,
+// and no larger than RPC_PAYLOAD_MAX. Each fd goes through a real socket,
+// as it does between the bridge and rpc_server.
+
+#define _GNU_SOURCE     // memfd_create()
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "payload.h"
+#include "test.h"
+
+#define TEST_PAYLOAD_MAX 4096
+
+static int sock[2];
+
+// Send 'fd' as the bridge would (envelope + SCM_RIGHTS) and map it on the
+// other end as 'size' bytes; 0 if payload_map_next() accepted it
+static int send_and_map(int fd, size_t size, struct payload_map *map)
+{
+    char env[PAYLOAD_ENVELOPE_MAX];
+    size_t env_len = payload_envelope(env, sizeof(env), size);
+    struct payload_fds fds = {0};
+    char buf[PAYLOAD_ENVELOPE_MAX];
+    size_t env_size = 0;
+
+    CHECK(payload_sendmsg(sock[0], env, env_len, fd, 0) == (ssize_t)env_len, "sendmsg");
+    close(fd);
+
+    ssize_t n = payload_recv(sock[1], buf, sizeof(buf), &fds);
+    CHECK(n == (ssize_t)env_len && fds.count == 1, "recv: %zd bytes, %u fds", n, fds.count);
+    CHECK(payload_is_envelope(buf, (size_t)n - 1, &env_size) && env_size == size, "envelope");
+
+    int ret = payload_map_next(&fds, env_size, map);
+    CHECK(fds.count == 0, "the fd is consumed either way");
+    payload_fds_close(&fds);
+    return ret;
+}
+
+static int unsealed_memfd(const char *data, size_t len)
+{
+    int fd = memfd_create("test-unsealed", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    CHECK(fd >= 0 && write(fd, data, len) == (ssize_t)len, "unsealed memfd");
+    return fd;
+}
+
+int main(void)
+{
+    static char data[TEST_PAYLOAD_MAX * 2];
+    struct payload_map map;
+
+    setenv("RPC_PAYLOAD_MAX", "4096", 1);
+    payload_config_load();
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sock) == 0, "socketpair");
+
+    memset(data, 'x', sizeof(data));
+    data[TEST_PAYLOAD_MAX - 1] = '\n';
+
+    // Sealed, right size: mapped, the trailing '\n' is not part of the message
+    CHECK(send_and_map(payload_memfd(data, TEST_PAYLOAD_MAX), TEST_PAYLOAD_MAX, &map) == 0,
+          "sealed memfd rejected");
+    CHECK(map.data && map.len == TEST_PAYLOAD_MAX - 1 &&
+          memcmp(map.data, data, map.len) == 0, "mapped contents");
+    payload_unmap(&map);
+    CHECK(!map.data, "unmapped");
+
+    // Not sealed: the sender could still rewrite or truncate it under the parser
+    CHECK(send_and_map(unsealed_memfd(data, 100), 100, &map) < 0, "unsealed memfd accepted");
+    CHECK(!map.data, "no mapping after a rejection");
+
+    // Sealed but larger than RPC_PAYLOAD_MAX
+    CHECK(send_and_map(payload_memfd(data, TEST_PAYLOAD_MAX + 1), TEST_PAYLOAD_MAX + 1, &map) < 0,
+          "oversized memfd accepted");
+    CHECK(!map.data, "no mapping after a rejection");
+
+    // Sealed, but the envelope claims another size
+    CHECK(send_and_map(payload_memfd(data, 100), 200, &map) < 0, "size mismatch accepted");
+
+    // An envelope without an fd
+    struct payload_fds none = {0};
+    CHECK(payload_map_next(&none, 100, &map) < 0, "envelope without an fd accepted");
+
+    close(sock[0]);
+    close(sock[1]);
+    return test_summary("test_payload");
+}
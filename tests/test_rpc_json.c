@@ -0,0 +1,146 @@
+// The schema reader's string scanner against json-c: both must agree on
+// what is valid JSON and on the decoded value. Known differences are checked
+// on their own: the scanner rejects \u0000, unpaired surrogates and raw
+// control characters, which json-c lets through.
+
+#include <stdlib.h>
+#include <string.h>
+#include <json-c/json.h>
+#include "rpc_json.h"
+#include "rpc_schema.h"
+#include "test.h"
+
+#define DOC_MAX 8192
+
+// json-c's reading of '{"name":...}': 1 with the string in 'out', 0 if the
+// document is valid but has no string "name", -1 if it is not valid JSON
+static int jsonc_name(const char *doc, char *out, size_t *out_len)
+{
+    json_tokener *tok = json_tokener_new();
+    size_t len = strlen(doc);
+    int ret = -1;
+
+    json_tokener_set_flags(tok, JSON_TOKENER_STRICT);
+    json_object *obj = json_tokener_parse_ex(tok, doc, (int)len);
+    size_t end = json_tokener_get_parse_end(tok);
+
+    while (end < len && (doc[end] == ' ' || doc[end] == '\n'))
+        end++;
+    if (obj && end == len && json_object_is_type(obj, json_type_object)) {
+        json_object *name = NULL;
+        ret = 0;
+        if (json_object_object_get_ex(obj, "name", &name) && json_object_is_type(name, json_type_string)) {
+            *out_len = (size_t)json_object_get_string_len(name);
+            memcpy(out, json_object_get_string(name), *out_len);
+            ret = 1;
+        }
+    }
+
+    json_object_put(obj);
+    json_tokener_free(tok);
+    return ret;
+}
+
+static void check_agrees(const char *doc)
+{
+    static char expect[DOC_MAX];
+    size_t expect_len = 0;
+    int ref = jsonc_name(doc, expect, &expect_len);
+
+    struct greet_welcome_params params;
+    int ret = greet_welcome_params_read(&params, doc, strlen(doc));
+
+    if (ref < 0) {
+        CHECK(ret == RPC_JSON_INVALID, "accepted invalid JSON: %s", doc);
+    } else if (ref == 0) {
+        CHECK(ret == RPC_JSON_MISSING, "expected no name (%d): %s", ret, doc);
+    } else {
+        CHECK(ret == RPC_JSON_OK && strlen(params.name) == expect_len &&
+              memcmp(params.name, expect, expect_len) == 0,
+              "decoded differently (%d): %s", ret, doc);
+    }
+    greet_welcome_params_free(&params);
+}
+
+static void check_rejected(const char *doc)
+{
+    struct greet_welcome_params params;
+
+    CHECK(greet_welcome_params_read(&params, doc, strlen(doc)) == RPC_JSON_INVALID,
+          "accepted: %s", doc);
+    greet_welcome_params_free(&params);
+}
+
+static const char *const fixed[] = {
+    "{\"name\":\"plain\"}",
+    "{\"name\":\"\"}",
+    "{ \"name\" : \"spaced\" }\n",
+    "{\"name\":\"q\\\" b\\\\ s\\/ \\b\\f\\n\\r\\t\"}",
+    "{\"name\":\"\\u0041\\u00e9\\u4e2d\\ud83d\\ude00\\uFFFF\"}",
+    "{\"name\":\"raw \xc3\xa9 \xe4\xb8\xad\"}",
+    "{\"x\":[1,-2.5e3,{\"y\":null,\"z\":[true,false]}],\"name\":\"after skip\"}",
+    "{\"name\":null}",
+    "{\"name\":42}",
+    "{\"other\":\"x\"}",
+    "{\"name\":\"unterminated}",
+    "{\"name\":\"bad \\x escape\"}",
+    "{\"name\":\"short \\u12\"}",
+    "{\"name\":\"bad hex \\u12G4\"}",
+    "{\"name\":\"a\",}",
+    "{\"name\":\"a\"} x",
+    "{\"name\" \"a\"}",
+    "[\"name\"]",
+    "{\"name\":tru}",
+    "{\"x\":01,\"name\":\"a\"}",
+    "{\"x\":[1,],\"name\":\"a\"}",
+};
+
+// The same fragments, glued at random into the value of "name"
+static const char *const fragments[] = {
+    "a", " ", "\xc3\xa9", "\\\"", "\\\\", "\\/", "\\n", "\\t", "\\u0041", "\\u00e9",
+    "\\u20ac", "a\\ud83d\\ude00", "\\", "\\x", "\\u12", "\"", "}", ",",
+};
+
+int main(void)
+{
+    static char doc[DOC_MAX];
+
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+        check_agrees(fixed[i]);
+
+    // Escape-heavy: every escape kind and every code point of the first 64K
+    // that is neither NUL nor a surrogate, in long runs
+    for (unsigned int base = 1; base < 0x10000; base += 256) {
+        size_t len = (size_t)snprintf(doc, sizeof(doc), "{\"name\":\"\\\"\\\\\\/\\b\\f\\n\\r\\t");
+        for (unsigned int cp = base; cp < base + 256 && cp < 0x10000; cp++) {
+            if (cp >= 0xd800 && cp < 0xe000)
+                continue;
+            len += (size_t)snprintf(doc + len, sizeof(doc) - len, "\\u%04x", cp);
+        }
+        snprintf(doc + len, sizeof(doc) - len, "\\ud800\\udc00\\udbff\\udfff\"}");
+        check_agrees(doc);
+    }
+
+    srand(1);
+    for (int i = 0; i < 5000; i++) {
+        size_t len = (size_t)snprintf(doc, sizeof(doc), "{\"name\":\"");
+        int n = rand() % 12;
+        for (int j = 0; j < n; j++)
+            len += (size_t)snprintf(doc + len, sizeof(doc) - len, "%s",
+                                    fragments[rand() % (sizeof(fragments) / sizeof(fragments[0]))]);
+        snprintf(doc + len, sizeof(doc) - len, "\"}");
+        check_agrees(doc);
+    }
+
+    // Valid JSON that the scanner refuses on purpose
+    check_rejected("{\"name\":\"nul \\u0000 inside\"}");
+    check_rejected("{\"name\":\"lone high \\ud83d\"}");
+    check_rejected("{\"name\":\"lone high \\ud83d then \\u0041\"}");
+    check_rejected("{\"name\":\"lone low \\ude00\"}");
+    check_rejected("{\"name\":\"reversed \\ude00\\ud83d\"}");
+    check_rejected("{\"name\":\"high at end \\ud83d");
+    check_rejected("{\"name\":\"raw control \x01\"}");
+    check_rejected("{\"name\":\"raw newline \n\"}");
+
+    return test_summary("test_rpc_json");
+}
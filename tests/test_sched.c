@@ -0,0 +1,195 @@
+// The bridge scheduler's dispatch order. With one request in flight at a time
+// a backlogged interactive class gets four turns for every bulk turn, control
+// jobs overtake both, and a cancelled job never runs. With more in flight,
+// no class goes over its own limit and no slot stays idle while work waits.
+
+#include <stdlib.h>
+#include <string.h>
+#include "bridge_sched.h"
+#include "test.h"
+
+#define JOBS_MAX 128
+
+struct test_job {
+    struct sched_job job;
+    char tag;               // 'C'ontrol, 'I'nteractive, 'B'ulk
+    bool ran;
+};
+
+static struct test_job jobs[JOBS_MAX];
+static unsigned int n_jobs;
+
+// Dispatch order, one tag per job started
+static char order[JOBS_MAX + 1];
+static unsigned int n_order;
+
+// Started and not yet done, oldest first
+static struct test_job *running[JOBS_MAX];
+static unsigned int n_running;
+
+static void test_run(struct sched_job *job)
+{
+    struct test_job *tj = container_of(job, struct test_job, job);
+
+    CHECK(!tj->ran, "job %c started twice", tj->tag);
+    tj->ran = true;
+    order[n_order++] = tj->tag;
+    running[n_running++] = tj;
+}
+
+static struct test_job *submit(enum sched_class cls)
+{
+    static const char tags[__SCHED_CLASS_MAX] = {
+        [SCHED_CONTROL] = 'C', [SCHED_INTERACTIVE] = 'I', [SCHED_BULK] = 'B',
+    };
+    struct test_job *tj = &jobs[n_jobs++];
+
+    tj->tag = tags[cls];
+    sched_submit(&tj->job, cls, test_run);
+    return tj;
+}
+
+// Finish the oldest running job; false if none was running
+static bool finish_oldest(void)
+{
+    if (!n_running)
+        return false;
+
+    struct test_job *tj = running[0];
+    memmove(running, running + 1, --n_running * sizeof(running[0]));
+    sched_done(&tj->job);
+    return true;
+}
+
+static unsigned int running_count(char tag)
+{
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < n_running; i++)
+        n += running[i]->tag == tag;
+    return n;
+}
+
+static unsigned int queued_count(char tag)
+{
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < n_jobs; i++)
+        n += jobs[i].tag == tag && jobs[i].job.queued;
+    return n;
+}
+
+static void reset(void)
+{
+    memset(jobs, 0, sizeof(jobs));
+    n_jobs = n_order = n_running = 0;
+    memset(order, 0, sizeof(order));
+}
+
+static void test_classify(void)
+{
+    CHECK(sched_classify("rpc.status", true, -1) == SCHED_CONTROL, "ubus control method");
+    CHECK(sched_classify("system.info", false, 0) == SCHED_CONTROL, "root control method");
+    CHECK(sched_classify("rpc.status", false, 1000) == SCHED_BULK, "unprivileged client in the control lane");
+    CHECK(sched_classify("rpc.status", false, -1) == SCHED_BULK, "unknown peer in the control lane");
+    CHECK(sched_classify("greet.welcome", true, -1) == SCHED_INTERACTIVE, "ubus caller");
+    CHECK(sched_classify("greet.welcome", false, 0) == SCHED_INTERACTIVE, "root client");
+    CHECK(sched_classify("greet.welcome", false, 1000) == SCHED_BULK, "unprivileged client");
+    CHECK(sched_classify("file.read", true, -1) == SCHED_BULK, "bulk prefix");
+    CHECK(sched_classify("backup.dump", false, 0) == SCHED_BULK, "bulk method");
+    CHECK(sched_classify("backup.dumps", false, 0) == SCHED_INTERACTIVE, "bulk method matched as a prefix");
+    CHECK(sched_classify(NULL, true, -1) == SCHED_INTERACTIVE, "no method");
+}
+
+// One request in flight: the order is fully determined by the scheduler
+static void test_weights(void)
+{
+    reset();
+
+    // Runs at once; everything after it queues up behind it
+    struct test_job *first = submit(SCHED_INTERACTIVE);
+    CHECK(n_running == 1 && order[0] == 'I', "first job not started at once");
+    CHECK(!sched_cancel(&first->job), "a running job was cancelled");
+
+    for (int i = 0; i < 40; i++)
+        submit(SCHED_INTERACTIVE);
+    for (int i = 0; i < 10; i++)
+        submit(SCHED_BULK);
+    CHECK(n_order == 1, "jobs started over the in-flight limit");
+
+    struct test_job *gone = submit(SCHED_BULK);
+    CHECK(sched_cancel(&gone->job) && !gone->job.queued, "queued job not cancelled");
+    CHECK(!sched_cancel(&gone->job), "job cancelled twice");
+
+    // A control job submitted mid-way is the very next one to start
+    unsigned int control_at = 0;
+    while (finish_oldest()) {
+        if (n_order == 13) {
+            submit(SCHED_CONTROL);
+            control_at = n_order;
+        }
+    }
+    CHECK(control_at && order[control_at] == 'C', "control job did not overtake: %s", order);
+    CHECK(n_order == 52 && !gone->ran, "%u jobs started", n_order);
+
+    // While both classes have work, every 5 consecutive turns hold exactly one bulk
+    char drr[JOBS_MAX];
+    unsigned int n = 0, last_bulk = 0;
+    for (unsigned int i = 1; i < n_order; i++) {
+        if (order[i] == 'C')
+            continue;
+        if (order[i] == 'B')
+            last_bulk = n;
+        drr[n++] = order[i];
+    }
+    for (unsigned int i = 0; i + 5 <= last_bulk + 1; i++) {
+        unsigned int bulk = 0;
+        for (unsigned int j = i; j < i + 5; j++)
+            bulk += drr[j] == 'B';
+        CHECK(bulk == 1, "turns %u..%u have %u bulk: %.*s", i, i + 4, bulk, (int)n, drr);
+    }
+}
+
+// Four in flight, interactive limited to two of them
+static void test_limits(void)
+{
+    reset();
+
+    for (int i = 0; i < 30; i++) {
+        submit(SCHED_INTERACTIVE);
+        submit(SCHED_BULK);
+    }
+
+    do {
+        CHECK(n_running <= 4, "%u in flight", n_running);
+        CHECK(running_count('I') <= 2, "%u interactive in flight", running_count('I'));
+
+        // Work conserving: a slot stays free only if nothing queued may use it
+        bool can_use = (queued_count('I') && running_count('I') < 2) || queued_count('B');
+        CHECK(n_running == 4 || !can_use, "idle slot with work queued (%u in flight)", n_running);
+
+        // The in-flight limit, not the weight, holds interactive back here. The
+        // credit it cannot use is kept, so it never cedes one of its two slots
+        CHECK(!queued_count('I') || running_count('I') == 2, "interactive ceded a slot: %s", order);
+    } while (finish_oldest());
+
+    CHECK(n_order == 60, "%u jobs started", n_order);
+}
+
+int main(void)
+{
+    setenv("RPC_SCHED_MAX_INFLIGHT", "1", 1);
+    setenv("RPC_SCHED_BULK_METHODS", "file.*,backup.dump", 1);
+    sched_init();
+
+    test_classify();
+    test_weights();
+
+    // Every queue is empty again: new limits can be loaded
+    setenv("RPC_SCHED_MAX_INFLIGHT", "4", 1);
+    setenv("RPC_SCHED_INTERACTIVE", "4,2", 1);
+    sched_init();
+    test_limits();
+
+    return test_summary("test_sched");
+}
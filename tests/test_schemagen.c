@@ -0,0 +1,200 @@
+// The readers rpc_schemagen generates for tests/schemagen_test.schema: every
+// member name must reach its own field through the perfect hash, in any
+// order, and no near miss (prefix, extension, one letter off) may reach one.
+// What a writer emits must read back the same.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "rpc_schema.h"
+#include "test.h"
+
+#define DOC_MAX 4096
+
+struct field {
+    const char *name;
+    uint32_t bit;
+    char type;              // 'i'nt, 's'tring, 'b'ool, 'r'aw
+    size_t off;             // of the value (the pointer for strings and raw)
+    size_t len_off;         // raw only
+};
+
+#define F_INT(f, B)  {#f, WIDE_HAS_##B, 'i', offsetof(struct wide, f), 0}
+#define F_STR(f, B)  {#f, WIDE_HAS_##B, 's', offsetof(struct wide, f), 0}
+#define F_BOOL(f, B) {#f, WIDE_HAS_##B, 'b', offsetof(struct wide, f), 0}
+#define F_RAW(f, B)  {#f, WIDE_HAS_##B, 'r', offsetof(struct wide, f), offsetof(struct wide, f##_len)}
+
+static const struct field fields[] = {
+    F_INT(id, ID), F_INT(ids, IDS), F_INT(di, DI), F_INT(i, I), F_INT(d, D),
+    F_STR(name, NAME), F_STR(names, NAMES), F_STR(mane, MANE), F_STR(nam, NAM),
+    F_STR(nme, NME), F_STR(name_, NAME_), F_STR(_name, _NAME),
+    F_BOOL(a, A), F_BOOL(b, B), F_BOOL(ab, AB), F_BOOL(ba, BA), F_BOOL(aa, AA), F_BOOL(bb, BB),
+    F_INT(x1, X1), F_INT(x2, X2), F_INT(x3, X3), F_INT(x10, X10), F_INT(x11, X11), F_INT(x12, X12),
+    F_RAW(params, PARAMS), F_RAW(param, PARAM), F_RAW(paramss, PARAMSS),
+    F_RAW(result, RESULT), F_RAW(results, RESULTS), F_RAW(error, ERROR), F_RAW(errors, ERRORS),
+    F_STR(err, ERR),
+};
+
+#define N_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+static bool is_field(const char *name)
+{
+    for (size_t i = 0; i < N_FIELDS; i++) {
+        if (strcmp(fields[i].name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// The value field 'k' gets in every document, as JSON
+static size_t put_member(char *doc, size_t size, size_t k)
+{
+    const struct field *f = &fields[k];
+
+    switch (f->type) {
+    case 'i': return (size_t)snprintf(doc, size, "\"%s\":%zu", f->name, k * 7 + 1);
+    case 's': return (size_t)snprintf(doc, size, "\"%s\":\"v%zu\"", f->name, k);
+    case 'b': return (size_t)snprintf(doc, size, "\"%s\":true", f->name);
+    default:  return (size_t)snprintf(doc, size, "\"%s\":[%zu,{\"k\":null}]", f->name, k);
+    }
+}
+
+static bool has_value(const struct wide *w, size_t k)
+{
+    const struct field *f = &fields[k];
+    const char *base = (const char *)w;
+    char expect[64];
+
+    switch (f->type) {
+    case 'i':
+        return *(const int *)(base + f->off) == (int)(k * 7 + 1);
+    case 's':
+        snprintf(expect, sizeof(expect), "v%zu", k);
+        return *(const char *const *)(base + f->off) &&
+               strcmp(*(const char *const *)(base + f->off), expect) == 0;
+    case 'b':
+        return *(const bool *)(base + f->off);
+    default:
+        snprintf(expect, sizeof(expect), "[%zu,{\"k\":null}]", k);
+        return *(const size_t *)(base + f->len_off) == strlen(expect) &&
+               memcmp(*(const char *const *)(base + f->off), expect, strlen(expect)) == 0;
+    }
+}
+
+static void check_all_fields(const char *doc, const char *what)
+{
+    struct wide w;
+
+    CHECK(wide_read(&w, doc, strlen(doc)) == RPC_JSON_OK, "%s: read", what);
+    CHECK(w.present == 0xffffffffu, "%s: present %08x", what, w.present);
+    for (size_t k = 0; k < N_FIELDS; k++)
+        CHECK(has_value(&w, k), "%s: field %s", what, fields[k].name);
+    wide_free(&w);
+}
+
+// '{"<key>":1,"err":"e"}' must set nothing but "err"
+static void check_near_miss(const char *key)
+{
+    char doc[128];
+    struct wide w;
+
+    if (is_field(key))
+        return;
+    snprintf(doc, sizeof(doc), "{\"%s\":1,\"err\":\"e\"}", key);
+    CHECK(wide_read(&w, doc, strlen(doc)) == RPC_JSON_OK && w.present == WIDE_HAS_ERR,
+          "key '%s' matched a field (present %08x)", key, w.present);
+    wide_free(&w);
+}
+
+int main(void)
+{
+    static char doc[DOC_MAX];
+    size_t len;
+    struct wide w;
+
+    // Every member, in schema order and reversed
+    len = (size_t)snprintf(doc, sizeof(doc), "{");
+    for (size_t k = 0; k < N_FIELDS; k++) {
+        len += put_member(doc + len, sizeof(doc) - len, k);
+        len += (size_t)snprintf(doc + len, sizeof(doc) - len, k + 1 < N_FIELDS ? "," : "}");
+    }
+    check_all_fields(doc, "schema order");
+
+    len = (size_t)snprintf(doc, sizeof(doc), "{ ");
+    for (size_t k = N_FIELDS; k-- > 0;) {
+        len += put_member(doc + len, sizeof(doc) - len, k);
+        len += (size_t)snprintf(doc + len, sizeof(doc) - len, k ? " , " : " }");
+    }
+    check_all_fields(doc, "reversed");
+
+    // What the writer emits reads back the same
+    CHECK(wide_read(&w, doc, strlen(doc)) == RPC_JSON_OK, "read for write");
+    struct rpc_jbuf jb;
+    size_t out_len = 0;
+    rpc_jbuf_init(&jb, 256);
+    wide_write(&jb, &w);
+    char *out = rpc_jbuf_finish(&jb, &out_len);
+    wide_free(&w);
+    CHECK(out != NULL, "write");
+    if (out)
+        check_all_fields(out, "written");
+    free(out);
+
+    // Each member on its own reaches exactly its field
+    for (size_t k = 0; k < N_FIELDS; k++) {
+        len = (size_t)snprintf(doc, sizeof(doc), "{");
+        len += put_member(doc + len, sizeof(doc) - len, k);
+        snprintf(doc + len, sizeof(doc) - len, ",\"err\":\"v%zu\"}", N_FIELDS - 1);
+
+        CHECK(wide_read(&w, doc, strlen(doc)) == RPC_JSON_OK &&
+              w.present == (fields[k].bit | WIDE_HAS_ERR) && has_value(&w, k),
+              "alone: %s (present %08x)", fields[k].name, w.present);
+        wide_free(&w);
+    }
+
+    // Near misses of every name, and keys no field has
+    for (size_t k = 0; k < N_FIELDS; k++) {
+        char key[64];
+        size_t n = strlen(fields[k].name);
+
+        snprintf(key, sizeof(key), "%sx", fields[k].name);
+        check_near_miss(key);
+        snprintf(key, sizeof(key), "x%s", fields[k].name);
+        check_near_miss(key);
+        snprintf(key, sizeof(key), "%.*s", (int)(n - 1), fields[k].name);
+        check_near_miss(key);
+        for (size_t c = 0; c < n; c++) {
+            snprintf(key, sizeof(key), "%s", fields[k].name);
+            key[c] = key[c] == 'q' ? 'r' : 'q';
+            check_near_miss(key);
+            snprintf(key, sizeof(key), "%s", fields[k].name);
+            if (key[c] >= 'a' && key[c] <= 'z') {
+                key[c] = (char)(key[c] - 'a' + 'A');
+                check_near_miss(key);
+            }
+        }
+    }
+    check_near_miss("");
+    check_near_miss("zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz");
+
+    // The required member
+    snprintf(doc, sizeof(doc), "{\"id\":1}");
+    CHECK(wide_read(&w, doc, strlen(doc)) == RPC_JSON_MISSING, "missing 'err' not reported");
+    wide_free(&w);
+
+    // A struct with a single member: a one-slot table still compares the key
+    struct one o;
+    const char *one_ok = "{\"only\":\"v\"}";
+    const char *const one_miss[] = {"{\"onl\":\"v\"}", "{\"onlyx\":\"v\"}", "{\"\":\"v\"}", "{\"ONLY\":\"v\"}"};
+
+    CHECK(one_read(&o, one_ok, strlen(one_ok)) == RPC_JSON_OK && strcmp(o.only, "v") == 0,
+          "one: only");
+    one_free(&o);
+    for (size_t i = 0; i < sizeof(one_miss) / sizeof(one_miss[0]); i++) {
+        CHECK(one_read(&o, one_miss[i], strlen(one_miss[i])) == RPC_JSON_MISSING && !o.present,
+              "one: %s matched", one_miss[i]);
+        one_free(&o);
+    }
+
+    return test_summary("test_schemagen");
+}
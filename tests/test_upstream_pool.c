@@ -0,0 +1,172 @@
+// The "hash" policy's ring. A key must map to the same instance every time
+// the pool is built from the same list. Losing an instance, by removal or by
+// an open circuit, must only move the keys it had, and adding one must only
+// move keys onto it. The instances are real listening sockets: the pick is
+// read from the call pool_call_start() makes, which is then cancelled.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <libubox/uloop.h>
+#include "upstream_pool.h"
+#include "test.h"
+
+#define N_SOCKS     4
+#define N_KEYS      300
+
+static char sock_paths[N_SOCKS][64];
+static int listen_fds[N_SOCKS];
+
+static int listen_at(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {0};
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    CHECK(fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+          listen(fd, 16) == 0, "listen on %s", path);
+    return fd;
+}
+
+// Nothing is served: accept and drop each connection so the backlog never fills
+static void drain(void)
+{
+    for (int i = 0; i < N_SOCKS; i++) {
+        int fd;
+        while ((fd = accept(listen_fds[i], NULL, NULL)) >= 0)
+            close(fd);
+    }
+}
+
+static void test_cb(struct pool_call *pc, int result)
+{
+    CHECK(0, "call completed (%d) before it was cancelled", result);
+}
+
+static void pool_build(struct upstream_pool *pool, const char *list)
+{
+    setenv("RPC_UPSTREAMS", list, 1);
+    upstream_pool_init(pool, "/nonexistent");
+}
+
+// Index into sock_paths of the instance 'key' is sent to, -1 on failure
+static int pick(struct upstream_pool *pool, const char *key)
+{
+    struct pool_call pc;
+    char *request = strdup("{\"jsonrpc\":\"2.0\",\"method\":\"greet.welcome\",\"id\":1}\n");
+    int idx = -1;
+
+    if (pool_call_start(&pc, pool, key, request, strlen(request), 0, test_cb) != UPSTREAM_OK) {
+        CHECK(0, "pool_call_start failed for %s", key);
+        return -1;
+    }
+    CHECK(!pc.retried, "%s: retried", key);
+
+    for (int i = 0; i < N_SOCKS; i++) {
+        if (strcmp(pc.calls[0].u->path, sock_paths[i]) == 0)
+            idx = i;
+    }
+
+    upstream_call_cancel(&pc.calls[0]);
+    pool_call_free(&pc);
+    free(pc.request);
+    drain();
+    return idx;
+}
+
+static void map_keys(struct upstream_pool *pool, int *map)
+{
+    char key[32];
+
+    for (int k = 0; k < N_KEYS; k++) {
+        snprintf(key, sizeof(key), "user%d", k);
+        map[k] = pick(pool, key);
+    }
+}
+
+int main(void)
+{
+    static struct upstream_pool pool;
+    char list[4 * 80];
+    int base[N_KEYS], map[N_KEYS], count[N_SOCKS] = {0};
+
+    for (int i = 0; i < N_SOCKS; i++) {
+        snprintf(sock_paths[i], sizeof(sock_paths[i]), "/tmp/test_pool.%d.%d", (int)getpid(), i);
+        listen_fds[i] = listen_at(sock_paths[i]);
+    }
+
+    uloop_init();
+    setenv("RPC_BALANCE", "hash", 1);
+    upstream_config_load();
+
+    // Three instances; the fourth socket is only used when one is added
+    snprintf(list, sizeof(list), "%s,%s,%s", sock_paths[0], sock_paths[1], sock_paths[2]);
+    pool_build(&pool, list);
+    CHECK(pool.n == 3 && upstream_pool_hash_param(&pool), "pool of 3 with the hash policy");
+    map_keys(&pool, base);
+
+    for (int k = 0; k < N_KEYS; k++) {
+        CHECK(base[k] >= 0 && base[k] < 3, "user%d: instance %d", k, base[k]);
+        if (base[k] >= 0)
+            count[base[k]]++;
+    }
+    // 64 points per instance: no instance is far from a third of the keys
+    for (int i = 0; i < 3; i++)
+        CHECK(count[i] >= N_KEYS / 5, "instance %d has only %d of %d keys", i, count[i], N_KEYS);
+
+    // Same list, same mapping, whatever the order in the list
+    pool_build(&pool, list);
+    map_keys(&pool, map);
+    CHECK(memcmp(map, base, sizeof(map)) == 0, "mapping changed on rebuild");
+
+    snprintf(list, sizeof(list), "%s,%s,%s", sock_paths[2], sock_paths[0], sock_paths[1]);
+    pool_build(&pool, list);
+    map_keys(&pool, map);
+    CHECK(memcmp(map, base, sizeof(map)) == 0, "mapping depends on the list order");
+
+    // Instance 1 removed: only its keys move
+    snprintf(list, sizeof(list), "%s,%s", sock_paths[0], sock_paths[2]);
+    pool_build(&pool, list);
+    map_keys(&pool, map);
+    for (int k = 0; k < N_KEYS; k++) {
+        CHECK(map[k] == 0 || map[k] == 2, "user%d: instance %d", k, map[k]);
+        CHECK(base[k] == 1 || map[k] == base[k], "user%d moved from %d to %d", k, base[k], map[k]);
+    }
+
+    // Instance 1's circuit open: the same keys move, and to the same place
+    int removed[N_KEYS];
+    memcpy(removed, map, sizeof(removed));
+    snprintf(list, sizeof(list), "%s,%s,%s", sock_paths[0], sock_paths[1], sock_paths[2]);
+    pool_build(&pool, list);
+    pool.upstreams[1].state = UPSTREAM_OPEN;
+    map_keys(&pool, map);
+    CHECK(memcmp(map, removed, sizeof(map)) == 0, "open circuit and removal disagree");
+
+    // Closed again: every key is back where it was
+    pool.upstreams[1].state = UPSTREAM_CLOSED;
+    map_keys(&pool, map);
+    CHECK(memcmp(map, base, sizeof(map)) == 0, "keys not back after the circuit closed");
+
+    // A fourth instance: keys only move onto it, and it takes a share
+    snprintf(list, sizeof(list), "%s,%s,%s,%s", sock_paths[0], sock_paths[1], sock_paths[2], sock_paths[3]);
+    pool_build(&pool, list);
+    map_keys(&pool, map);
+    int moved = 0;
+    for (int k = 0; k < N_KEYS; k++) {
+        CHECK(map[k] == base[k] || map[k] == 3, "user%d moved from %d to %d", k, base[k], map[k]);
+        moved += map[k] == 3;
+    }
+    CHECK(moved >= N_KEYS / 8 && moved <= N_KEYS / 2, "%d of %d keys moved to the new instance",
+          moved, N_KEYS);
+
+    for (int i = 0; i < N_SOCKS; i++) {
+        close(listen_fds[i]);
+        unlink(sock_paths[i]);
+    }
+    uloop_done();
+    return test_summary("test_upstream_pool");
+}